@@ -1,39 +1,82 @@
 #pragma once
 
-#include "PooledStore.h"
+#include "PackedStore.h"
 
-template<StoreCompatible... Ts>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+template<ComponentCompatible... Ts>
 class ParallelPooledStore;
 
 template<typename... TComponents>
-class Archetype
-{
-private:
-	template<typename TTarget, typename... TComps>
-	struct ContainsInternal;
+class Archetype;
 
-	template<typename TTarget>
-	struct ContainsInternal<TTarget>
+// Id of a type that is the same in every translation unit and doesn't depend on declaration order, a hash of the
+// signature the compiler spells the type in
+template<typename T>
+constexpr std::uint64_t GetTypeId()
+{
+#ifdef _MSC_VER
+	std::string_view name = __FUNCSIG__;
+#else
+	std::string_view name = __PRETTY_FUNCTION__;
+#endif
+
+	std::uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (char c : name)
 	{
-		static inline constexpr bool Value = false;
-	};
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
 
-	template<typename TTarget, typename TComp>
-	struct ContainsInternal<TTarget, TComp>
-	{
-		static inline constexpr bool Value = std::is_same_v<TTarget, TComp>;
-	};
+	return hash;
+}
+
+template<typename T>
+inline constexpr std::uint64_t TYPE_BIT = 1ull << (GetTypeId<T>() % 64);
 
-	template<typename TTarget, typename TComp, typename... TComps>
-	struct ContainsInternal<TTarget, TComp, TComps...>
+// Archetype and store of the components ordered by type id, the same for every order of the same components
+template<typename... TComponents>
+struct CanonicalArchetype
+{
+private:
+	static constexpr auto SORTED = []<std::size_t... Indices>(std::index_sequence<Indices...>)
 	{
-		static inline constexpr bool Value = 
-			ContainsInternal<TTarget, TComp>::Value || ContainsInternal<TTarget, TComps...>::Value;
-	};
+		std::array<std::pair<std::uint64_t, std::size_t>, sizeof...(TComponents)> ids = { std::pair(GetTypeId<TComponents>(), Indices)... };
+		std::ranges::sort(ids);
+		return ids;
+	}(std::index_sequence_for<TComponents...>());
 
+	template<std::size_t Index>
+	using SortedAt = std::tuple_element_t<SORTED[Index].second, std::tuple<TComponents...>>;
+
+	template<std::size_t... Indices>
+	static auto MakeArchetype(std::index_sequence<Indices...>) -> Archetype<SortedAt<Indices>...>;
+
+	template<std::size_t... Indices>
+	static auto MakeStore(std::index_sequence<Indices...>) -> ParallelPooledStore<SortedAt<Indices>...>;
+public:
+	using Type = decltype(MakeArchetype(std::index_sequence_for<TComponents...>()));
+	using StoreType = decltype(MakeStore(std::index_sequence_for<TComponents...>()));
+};
+
+template<typename... TComponents>
+class Archetype
+{
+private:
 	template<typename TArchOther, typename... TComps>
 	struct UnionParts;
 
+	template<typename TArchOther>
+	struct UnionParts<TArchOther>
+	{
+		using Type = TArchOther;
+	};
+
 	template<typename TArchOther, typename TComp>
 	struct UnionParts<TArchOther, TComp>
 	{
@@ -60,16 +103,53 @@ public:
 	template<typename TArchOther>
 	using Union = TArchOther::template Append<TComponents...>;
 
-	using StoreType = ParallelPooledStore<TComponents...>;
+	// Equivalent archetypes, the same components in any order, share the canonical archetype and its store
+	using Canonical = CanonicalArchetype<TComponents...>::Type;
+	using StoreType = CanonicalArchetype<TComponents...>::StoreType;
+
+	// Type ids of the components in ascending order
+	static inline constexpr std::array<std::uint64_t, sizeof...(TComponents)> TYPE_IDS = []()
+	{
+		std::array<std::uint64_t, sizeof...(TComponents)> ids = { GetTypeId<TComponents>()... };
+		std::ranges::sort(ids);
+		return ids;
+	}();
+
+	// A bit per component picked by its type id. Most failed checks end at these without looking at the ids
+	static inline constexpr std::uint64_t TYPE_BITS = (TYPE_BIT<TComponents> | ... | 0ull);
 
 	template<typename TComp>
-	static inline constexpr bool Contains = Archetype<TComponents...>::template ContainsInternal<TComp, TComponents...>::Value;
+	static inline constexpr bool Contains = (TYPE_BITS & TYPE_BIT<TComp>) && std::ranges::binary_search(TYPE_IDS, GetTypeId<TComp>());
+
+	// Position of the component, the component count if it isn't one
+	template<typename TComp>
+	static inline constexpr std::size_t IndexOf = []()
+	{
+		std::size_t index = 0;
+		bool found = false;
+		((found = found || std::is_same_v<TComp, TComponents>, index += !found), ...);
+		return index;
+	}();
 
 	template<typename TArchSuperset>
-	static inline constexpr bool IsSubsetOf = ((TArchSuperset::template Contains<TComponents>) && ...);
+	static inline constexpr bool IsSubsetOf = (TYPE_BITS & ~TArchSuperset::TYPE_BITS) == 0 && std::ranges::includes(TArchSuperset::TYPE_IDS, TYPE_IDS);
 
 	template<typename TArchSuperset>
-	static inline constexpr bool AnyIn = ((TArchSuperset::template Contains<TComponents>) || ...);
+	static inline constexpr bool AnyIn = (TYPE_BITS & TArchSuperset::TYPE_BITS) != 0 && []()
+	{
+		// Both id lists are sorted, so one pass over them finds any shared id
+		auto other = TArchSuperset::TYPE_IDS.begin();
+		for (auto id : TYPE_IDS)
+		{
+			while (other != TArchSuperset::TYPE_IDS.end() && *other < id)
+				++other;
+
+			if (other != TArchSuperset::TYPE_IDS.end() && *other == id)
+				return true;
+		}
+
+		return false;
+	}();
 
 	template<typename TArch>
 	static inline constexpr bool MeetsAnyCriterion = ((TComponents::template IsSubsetOf<TArch>) || ...);
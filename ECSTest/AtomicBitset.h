@@ -1,42 +1,53 @@
 #pragma once
 
 #include "MemoryPool.h"
+#include "RadixIndex.h"
 #include <atomic>
+#include <ranges>
 
-template<std::size_t MinBits>
+// Grows one block at a time without an upper bound, blocks are found through a RadixIndex. Summary bits mark
+// which words and which blocks hold any ones, so searches jump over empty regions instead of reading every word
 class AtomicBitset
 {
 private:
+	static const std::size_t WORDS_PER_BLOCK = BLOCK_SIZE / sizeof(std::atomic_size_t);
+	static const std::size_t BITS_PER_BLOCK = WORDS_PER_BLOCK * 64;
+	static const std::size_t BLOCKS_PER_SUMMARY = 32;
+
 	struct AtomicBitsetBlock
 	{
-		std::atomic_size_t Bits[BLOCK_SIZE / sizeof(std::atomic_size_t)];
+		std::atomic_size_t Bits[WORDS_PER_BLOCK] = {};
 	};
 
-	static const std::size_t BLOCK_COUNT = std::max(MinBits / 8, BLOCK_SIZE) / (BLOCK_SIZE);
+	// Bit i of Blocks is set if block i has a one, bit j of Words[i][k] if word 64 * k + j of block i has a one.
+	// Bits may be set for regions that are empty by now, never the other way around once writers are done
+	struct SummaryNode
+	{
+		std::atomic_size_t Blocks = 0;
+		std::atomic_size_t Words[BLOCKS_PER_SUMMARY][WORDS_PER_BLOCK / 64] = {};
+	};
 
-	static const std::size_t BLOCK_BITS = std::bit_width(BLOCK_COUNT - 1);
-	static const std::size_t OFFSET_BITS = std::bit_width(BLOCK_SIZE / sizeof(std::atomic_size_t) - 1);
+	static const std::size_t OFFSET_BITS = std::bit_width(WORDS_PER_BLOCK - 1);
 	static const std::size_t INTERNAL_SHIFT_BITS = 6;
 
-	inline static std::tuple<std::uint16_t, std::uint16_t, std::uint16_t> GetComponents(std::size_t index)
+	inline static std::tuple<std::size_t, std::size_t, std::size_t> GetComponents(std::size_t index)
 	{
 		auto internal = index & ~(~0ull << INTERNAL_SHIFT_BITS);
 		auto offset = (index >> INTERNAL_SHIFT_BITS) & ~(~0ull << OFFSET_BITS);
-		auto block = (index >> (INTERNAL_SHIFT_BITS + OFFSET_BITS)) & ~(~0ull << BLOCK_BITS);
+		auto block = index >> (INTERNAL_SHIFT_BITS + OFFSET_BITS);
 
 		return { block, offset, internal };
 	}
-
-	inline static std::size_t ToIndex(std::uint16_t block, std::uint8_t offset, std::uint8_t bit)
-	{
-		return bit | (offset << INTERNAL_SHIFT_BITS) | (block << (INTERNAL_SHIFT_BITS + OFFSET_BITS));
-	}
 public:
-	template<bool Destructive>
+	static const std::size_t NO_ONE = std::numeric_limits<std::size_t>::max();
+
+	// Visits set bits in increasing order, or decreasing if Reverse, within [begin, end) of the bitset.
+	// The destructive version clears each bit as it reaches it
+	template<bool Destructive, bool Reverse = false>
 	class OnesIterator
 	{
 	public:
-		using iterator = OnesIterator<Destructive>;
+		using iterator = OnesIterator<Destructive, Reverse>;
 		using reference = std::size_t&;
 		using pointer = std::size_t *;
 
@@ -44,24 +55,18 @@ public:
 		using value_type = std::size_t;
 		using difference_type = std::ptrdiff_t;
 
-		OnesIterator(AtomicBitset *bitset, std::size_t index) : 
-			m_onesLeft(bitset->m_oneCount), m_bitset(bitset), m_curIndex(0), m_curBitIndex(0), m_curBlockIndex(0), 
-			m_initialOnes(bitset->m_oneCount)
+		OnesIterator(AtomicBitset *bitset, std::size_t begin, std::size_t end = NO_ONE) : 
+			m_bitset(bitset), m_beginIndex(begin), m_endIndex(end)
 		{
-			if (m_onesLeft == 0) return;
+			if constexpr (Reverse)
+				m_curIndex = end > begin ? Find(end - 1) : NO_ONE;
+			else
+				m_curIndex = Find(begin);
 
-			m_curBlock = bitset->m_blocks[0].Load();
-			if (m_curBlock)
-			{
-				m_curBitvec = &m_curBlock->Bits[0];
-				if (!(m_curBitvec->load() & 1))
-				{
-					FindNextOne();
-				}
-			}
+			Visit();
 		}
 
-		OnesIterator() : m_onesLeft(0)
+		OnesIterator() : m_bitset(nullptr), m_curIndex(NO_ONE), m_beginIndex(0), m_endIndex(NO_ONE)
 		{
 		}
 
@@ -74,183 +79,445 @@ public:
 
 		iterator& operator++()
 		{
-			m_onesLeft = std::min(m_bitset->m_oneCount.load(), m_initialOnes) + (m_onesLeft - m_initialOnes);
-			m_initialOnes = m_bitset->m_oneCount;
+			if constexpr (Reverse)
+				m_curIndex = m_curIndex > m_beginIndex ? Find(m_curIndex - 1) : NO_ONE;
+			else
+				m_curIndex = Find(m_curIndex + 1);
 
-			if (m_onesLeft > 1)
-			{
-				FindNextOne();
-				if constexpr (Destructive)
-				{
-					*m_curBitvec ^= 1ull << m_curBitIndex;
-					--m_bitset->m_oneCount;
-				}
-			}
-			--m_onesLeft;
+			Visit();
 
 			return *this;
 		}
 
-		value_type operator*()
+		// Moves to the first one at or after index, if that's ahead
+		void SkipTo(std::size_t index) requires (!Destructive && !Reverse)
+		{
+			if (m_curIndex < index)
+				m_curIndex = Find(index);
+		}
+
+		value_type operator*() const
 		{
 			return m_curIndex;
 		}
 
 		auto operator<=>(const iterator& other) const
 		{
-			return other.m_onesLeft <=> m_onesLeft;
+			return m_curIndex <=> other.m_curIndex;
 		}
 
 		auto operator==(const iterator& other) const
 		{
-			return m_onesLeft == other.m_onesLeft;
+			return m_curIndex == other.m_curIndex;
 		}
 	private:
-		void FindNextOne()
-		{
-			++m_curIndex;
+		AtomicBitset *m_bitset;
+		std::size_t m_curIndex;
+		std::size_t m_beginIndex;
+		std::size_t m_endIndex;
 
-			do
+		std::size_t Find(std::size_t index) const
+		{
+			if constexpr (Reverse)
+			{
+				auto one = m_bitset->FindPrevOne(index);
+				return one != NO_ONE && one >= m_beginIndex ? one : NO_ONE;
+			}
+			else
 			{
-				auto [blockIndex, offsetIndex, bitIndex] = GetComponents(m_curIndex);
-
-				if (blockIndex != m_curBlockIndex)
-				{
-					m_curBlockIndex = blockIndex;
-					m_curBlock = m_bitset->m_blocks[blockIndex].Load();
-
-					m_curBitvecIndex = offsetIndex;
-					m_curBitvec = &m_curBlock->Bits[offsetIndex];
-				}
-
-				m_curBitvecIndex = offsetIndex;
-				m_curBitvec = &m_curBlock->Bits[offsetIndex];
-				
-				auto curVal = m_curBitvec->load() & (~0ull << bitIndex);
-				if (curVal == 0)
-				{
-					m_curIndex += 64 - bitIndex;
-				}
-				else
-				{
-					m_curBitIndex = std::countr_zero(curVal);
-					break;
-				}
-
-			} while (true);
+				auto one = m_bitset->FindNextOne(index);
+				return one < m_endIndex ? one : NO_ONE;
+			}
 		}
 
-		AtomicBitset *m_bitset;
-
-		AtomicBitsetBlock *m_curBlock;
-		std::atomic_size_t *m_curBitvec;
-		
-		std::size_t m_curIndex;
-		std::size_t m_curBlockIndex;
-		std::size_t m_curBitvecIndex;
-		std::size_t m_curBitIndex;
-
-		std::size_t m_onesLeft;
-		std::size_t m_initialOnes;
+		void Visit()
+		{
+			if constexpr (Destructive)
+			{
+				if (m_curIndex != NO_ONE)
+					m_bitset->Set(m_curIndex, false);
+			}
+		}
 	};
 
 	bool Get(std::size_t index);
 	void Set(std::size_t index, bool value);
+
+	// Index of the first set bit at or after index, NO_ONE if there is none
+	std::size_t FindNextOne(std::size_t index);
+
+	// Index of the last set bit at or before index, NO_ONE if there is none
+	std::size_t FindPrevOne(std::size_t index);
+
+	// Word at a time over [begin, end), skipping empty words and blocks where the summary allows
+	void SetRange(std::size_t begin, std::size_t end);
+	void ClearRange(std::size_t begin, std::size_t end);
+	std::size_t CountRange(std::size_t begin, std::size_t end);
+
+	// Sets the bits of mask in the word holding index, returns how many of them weren't set before
+	std::size_t SetWordBits(std::size_t index, std::uint64_t mask);
+
+	// The 64 bits of the word holding index, with the word's first bit in the lowest position
+	std::size_t GetWord(std::size_t index);
 	std::size_t GetSize();
 	std::size_t GetOneCount();
 	void GrowBitsTo(std::size_t minBitCount);
 
+	// Blocks allocated from now on come from this NUMA node, ANY_NUMA_NODE follows the allocating thread
+	void SetPreferredNode(std::size_t node);
+
 	OnesIterator<false> ReadonlyBegin();
 	OnesIterator<false> ReadonlyEnd();
 
 	OnesIterator<true> begin();
 	OnesIterator<true> end();
+
+	// Read-only ones in [begin, end), ascending or descending
+	auto Ones(std::size_t begin, std::size_t end);
+	auto ReverseOnes(std::size_t begin, std::size_t end);
 private:
 	void Grow();
 
-	std::array<MemoryPool::Ptr<AtomicBitsetBlock>, BLOCK_COUNT> m_blocks;
+	// Calls func(bits, mask, block, offset) for every word overlapping [begin, end), mask selecting the bits inside
+	template<typename TFunc>
+	void ForEachWord(std::size_t begin, std::size_t end, TFunc func);
+
+	void MarkWord(std::size_t block, std::size_t offset);
+	void UnmarkWord(std::size_t block, std::size_t offset, std::atomic_size_t& bits);
+
+	RadixIndex<AtomicBitsetBlock> m_blocks;
+	RadixIndex<SummaryNode> m_summaries;
+	std::size_t m_node = ANY_NUMA_NODE;
 	std::atomic_size_t m_count = 0;
 	std::atomic_size_t m_oneCount = 0;
 };
 
-template<std::size_t MinBits>
-inline bool AtomicBitset<MinBits>::Get(std::size_t index)
+inline bool AtomicBitset::Get(std::size_t index)
 {
 	auto [block, offset, bit] = GetComponents(index);
-	return (m_blocks[block]->Bits[offset] >> bit) & 1;
+	return (m_blocks.Find(block)->Bits[offset] >> bit) & 1;
 }
 
-template<std::size_t MinBits>
-inline void AtomicBitset<MinBits>::Set(std::size_t index, bool value)
+inline void AtomicBitset::Set(std::size_t index, bool value)
 {
 	auto [block, offset, bit] = GetComponents(index);
-	auto& bits = m_blocks[block]->Bits[offset];
+	auto& bits = m_blocks.Find(block)->Bits[offset];
 	if (value)
 	{
 		auto oldBits = bits.fetch_or(1ull << bit);
 		if (!(oldBits & (1ull << bit)))
 			++m_oneCount;
+
+		if (oldBits == 0)
+			MarkWord(block, offset);
 	}
 	else
 	{
-		auto ones = m_oneCount.load();
-		auto oldBits = bits.fetch_xor(1ull << bit);
+		auto oldBits = bits.fetch_and(~(1ull << bit));
 		if (oldBits & (1ull << bit))
 			--m_oneCount;
+
+		if (oldBits == (1ull << bit))
+			UnmarkWord(block, offset, bits);
+	}
+}
+
+inline std::size_t AtomicBitset::FindNextOne(std::size_t index)
+{
+	const auto bitsPerSummary = BLOCKS_PER_SUMMARY * BITS_PER_BLOCK;
+	const auto bitsPerSummaryWord = 64 * 64;
+
+	auto size = m_count.load();
+
+	while (index < size)
+	{
+		auto [block, offset, bit] = GetComponents(index);
+		auto summary = m_summaries.Find(block / BLOCKS_PER_SUMMARY);
+		auto summaryBlock = block % BLOCKS_PER_SUMMARY;
+
+		// Jump to the next block with ones, a missing summary is still being grown into and has none
+		auto blocks = summary ? summary->Blocks.load() & (~0ull << summaryBlock) : 0;
+		if (blocks == 0)
+		{
+			index = (index / bitsPerSummary + 1) * bitsPerSummary;
+			continue;
+		}
+		else if (static_cast<std::size_t>(std::countr_zero(blocks)) != summaryBlock)
+		{
+			index = (block - summaryBlock + std::countr_zero(blocks)) * BITS_PER_BLOCK;
+			continue;
+		}
+
+		// Jump to the next word with ones
+		auto words = summary->Words[summaryBlock][offset / 64].load() & (~0ull << (offset % 64));
+		if (words == 0)
+		{
+			index = (index / bitsPerSummaryWord + 1) * bitsPerSummaryWord;
+			continue;
+		}
+		else if (static_cast<std::size_t>(std::countr_zero(words)) != offset % 64)
+		{
+			index = index / bitsPerSummaryWord * bitsPerSummaryWord + std::countr_zero(words) * 64;
+			continue;
+		}
+
+		auto bits = m_blocks.Find(block)->Bits[offset].load() & (~0ull << bit);
+		if (bits != 0)
+		{
+			auto one = index - bit + std::countr_zero(bits);
+			return one < size ? one : NO_ONE;
+		}
+
+		index = index - bit + 64;
+	}
+
+	return NO_ONE;
+}
+
+inline std::size_t AtomicBitset::FindPrevOne(std::size_t index)
+{
+	const auto bitsPerSummary = BLOCKS_PER_SUMMARY * BITS_PER_BLOCK;
+	const auto bitsPerSummaryWord = 64 * 64;
+
+	auto size = m_count.load();
+	if (size == 0)
+		return NO_ONE;
+
+	index = std::min(index, size - 1);
+
+	while (true)
+	{
+		auto [block, offset, bit] = GetComponents(index);
+		auto summary = m_summaries.Find(block / BLOCKS_PER_SUMMARY);
+		auto summaryBlock = block % BLOCKS_PER_SUMMARY;
+
+		// Jump back to the previous block with ones
+		auto blocks = summary ? summary->Blocks.load() & (~0ull >> (63 - summaryBlock)) : 0;
+		if (blocks == 0)
+		{
+			if (index < bitsPerSummary)
+				return NO_ONE;
+
+			index = index / bitsPerSummary * bitsPerSummary - 1;
+			continue;
+		}
+		else if (static_cast<std::size_t>(63 - std::countl_zero(blocks)) != summaryBlock)
+		{
+			index = (block - summaryBlock + 63 - std::countl_zero(blocks) + 1) * BITS_PER_BLOCK - 1;
+			continue;
+		}
+
+		// Jump back to the previous word with ones
+		auto words = summary->Words[summaryBlock][offset / 64].load() & (~0ull >> (63 - offset % 64));
+		if (words == 0)
+		{
+			if (index < bitsPerSummaryWord)
+				return NO_ONE;
+
+			index = index / bitsPerSummaryWord * bitsPerSummaryWord - 1;
+			continue;
+		}
+		else if (static_cast<std::size_t>(63 - std::countl_zero(words)) != offset % 64)
+		{
+			index = index / bitsPerSummaryWord * bitsPerSummaryWord + (63 - std::countl_zero(words)) * 64 + 63;
+			continue;
+		}
+
+		auto bits = m_blocks.Find(block)->Bits[offset].load() & (~0ull >> (63 - bit));
+		if (bits != 0)
+			return index - bit + 63 - std::countl_zero(bits);
+
+		if (index < 64)
+			return NO_ONE;
+
+		index = index - bit - 1;
+	}
+}
+
+inline void AtomicBitset::SetRange(std::size_t begin, std::size_t end)
+{
+	ForEachWord(begin, end, [this](std::atomic_size_t& bits, std::uint64_t mask, std::size_t block, std::size_t offset)
+	{
+		auto oldBits = bits.fetch_or(mask);
+		m_oneCount += std::popcount(mask & ~oldBits);
+
+		if (oldBits == 0)
+			MarkWord(block, offset);
+	});
+}
+
+inline void AtomicBitset::ClearRange(std::size_t begin, std::size_t end)
+{
+	// Only words with ones need to be touched
+	for (auto index = FindNextOne(begin); index < end; index = FindNextOne(index))
+	{
+		auto wordEnd = std::min((index | 63) + 1, end);
+
+		ForEachWord(index, wordEnd, [this](std::atomic_size_t& bits, std::uint64_t mask, std::size_t block, std::size_t offset)
+		{
+			auto oldBits = bits.fetch_and(~mask);
+			m_oneCount -= std::popcount(mask & oldBits);
+
+			if (oldBits != 0 && (oldBits & ~mask) == 0)
+				UnmarkWord(block, offset, bits);
+		});
+
+		index = wordEnd;
 	}
 }
 
-template<std::size_t MinBits>
-inline std::size_t AtomicBitset<MinBits>::GetSize()
+inline std::size_t AtomicBitset::CountRange(std::size_t begin, std::size_t end)
+{
+	std::size_t count = 0;
+
+	for (auto index = FindNextOne(begin); index < end; index = FindNextOne(index))
+	{
+		auto wordEnd = std::min((index | 63) + 1, end);
+
+		ForEachWord(index, wordEnd, [&count](std::atomic_size_t& bits, std::uint64_t mask, std::size_t, std::size_t)
+		{
+			count += std::popcount(bits.load() & mask);
+		});
+
+		index = wordEnd;
+	}
+
+	return count;
+}
+
+inline std::size_t AtomicBitset::SetWordBits(std::size_t index, std::uint64_t mask)
+{
+	auto [block, offset, bit] = GetComponents(index);
+	auto& bits = m_blocks.Find(block)->Bits[offset];
+
+	auto oldBits = bits.fetch_or(mask);
+	auto added = static_cast<std::size_t>(std::popcount(mask & ~oldBits));
+	m_oneCount += added;
+
+	if (oldBits == 0 && mask != 0)
+		MarkWord(block, offset);
+
+	return added;
+}
+
+inline std::size_t AtomicBitset::GetWord(std::size_t index)
+{
+	auto [block, offset, bit] = GetComponents(index);
+	auto loadedBlock = m_blocks.Find(block);
+
+	return loadedBlock ? loadedBlock->Bits[offset].load() : 0;
+}
+
+inline std::size_t AtomicBitset::GetSize()
 {
 	return m_count;
 }
 
-template<std::size_t MinBits>
-inline std::size_t AtomicBitset<MinBits>::GetOneCount()
+inline std::size_t AtomicBitset::GetOneCount()
 {
 	return m_oneCount;
 }
 
-template<std::size_t MinBits>
-inline void AtomicBitset<MinBits>::GrowBitsTo(std::size_t minBitCount)
+inline void AtomicBitset::GrowBitsTo(std::size_t minBitCount)
 {
 	while (m_count < minBitCount)
 		Grow();
 }
 
-template<std::size_t MinBits>
-inline AtomicBitset<MinBits>::OnesIterator<false> AtomicBitset<MinBits>::ReadonlyBegin()
+inline void AtomicBitset::SetPreferredNode(std::size_t node)
+{
+	m_node = node;
+}
+
+inline AtomicBitset::OnesIterator<false> AtomicBitset::ReadonlyBegin()
 {
 	return OnesIterator<false>(this, 0);
 }
 
-template<std::size_t MinBits>
-inline AtomicBitset<MinBits>::OnesIterator<false> AtomicBitset<MinBits>::ReadonlyEnd()
+inline AtomicBitset::OnesIterator<false> AtomicBitset::ReadonlyEnd()
 {
 	return OnesIterator<false>();
 }
 
-template<std::size_t MinBits>
-inline AtomicBitset<MinBits>::OnesIterator<true> AtomicBitset<MinBits>::begin()
+inline AtomicBitset::OnesIterator<true> AtomicBitset::begin()
 {
 	return OnesIterator<true>(this, 0);
 }
 
-template<std::size_t MinBits>
-inline AtomicBitset<MinBits>::OnesIterator<true> AtomicBitset<MinBits>::end()
+inline AtomicBitset::OnesIterator<true> AtomicBitset::end()
 {
 	return OnesIterator<true>();
 }
 
-template<std::size_t MinBits>
-inline void AtomicBitset<MinBits>::Grow()
+inline auto AtomicBitset::Ones(std::size_t begin, std::size_t end)
+{
+	return std::ranges::subrange(OnesIterator<false>(this, begin, end), OnesIterator<false>());
+}
+
+inline auto AtomicBitset::ReverseOnes(std::size_t begin, std::size_t end)
+{
+	return std::ranges::subrange(OnesIterator<false, true>(this, begin, end), OnesIterator<false, true>());
+}
+
+inline void AtomicBitset::Grow()
+{
+	auto [block, offset, bit] = GetComponents(m_count.fetch_add(BITS_PER_BLOCK));
+
+	// Blocks start out cleared, the summary is created before the block so Set always finds it
+	m_summaries.FindOrCreate(block / BLOCKS_PER_SUMMARY, m_node);
+	m_blocks.FindOrCreate(block, m_node);
+}
+
+template<typename TFunc>
+inline void AtomicBitset::ForEachWord(std::size_t begin, std::size_t end, TFunc func)
 {
-	auto [block, offset, bit] = GetComponents(m_count.fetch_add(BLOCK_SIZE * 8));
-	
-	auto allocBlock = MemoryPool::RequestBlock<AtomicBitsetBlock>();
-	std::fill_n(allocBlock->Bits, BLOCK_SIZE / sizeof(std::atomic_size_t), 0ull);
+	AtomicBitsetBlock *loadedBlock = nullptr;
+	std::size_t loadedIndex = NO_ONE;
+
+	while (begin < end)
+	{
+		auto [block, offset, bit] = GetComponents(begin);
+		auto count = std::min(64 - bit, end - begin);
+		auto mask = (count == 64 ? ~0ull : ~(~0ull << count)) << bit;
+
+		if (block != loadedIndex)
+		{
+			loadedBlock = m_blocks.Find(block);
+			loadedIndex = block;
+		}
+
+		func(loadedBlock->Bits[offset], mask, block, offset);
+		begin += count;
+	}
+}
+
+inline void AtomicBitset::MarkWord(std::size_t block, std::size_t offset)
+{
+	auto summary = m_summaries.Find(block / BLOCKS_PER_SUMMARY);
+	auto summaryBlock = block % BLOCKS_PER_SUMMARY;
+
+	auto oldWords = summary->Words[summaryBlock][offset / 64].fetch_or(1ull << (offset % 64));
+	if (oldWords == 0)
+		summary->Blocks.fetch_or(1ull << summaryBlock);
+}
+
+inline void AtomicBitset::UnmarkWord(std::size_t block, std::size_t offset, std::atomic_size_t& bits)
+{
+	auto summary = m_summaries.Find(block / BLOCKS_PER_SUMMARY);
+	auto summaryBlock = block % BLOCKS_PER_SUMMARY;
+	auto& words = summary->Words[summaryBlock];
+
+	auto oldWords = words[offset / 64].fetch_and(~(1ull << (offset % 64)));
+
+	// A concurrent Set may have refilled the word before its summary bit was cleared, so check again afterwards
+	if (bits.load() != 0)
+		MarkWord(block, offset);
+
+	if (oldWords != (1ull << (offset % 64)) || std::any_of(std::begin(words), std::end(words), [](auto& w) { return w.load() != 0; }))
+		return;
+
+	summary->Blocks.fetch_and(~(1ull << summaryBlock));
 
-	m_blocks[block] = std::move(allocBlock);
-	m_blocks[block].NotifyNonnull();
+	if (std::any_of(std::begin(words), std::end(words), [](auto& w) { return w.load() != 0; }))
+		summary->Blocks.fetch_or(1ull << summaryBlock);
 }
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Archetype.h"
+
+#include <concepts>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+template<typename... TArchetypes>
+class EcsStorage;
+
+// Structural changes recorded by one thread and applied later by EcsStorage::Playback at a sync point between
+// systems. Recording only appends to the buffer's own vectors, so systems running in parallel can each fill one
+// (e.g. picked with ThreadPool::GetCurrentThreadIndex) without touching the stores
+template<typename... TArchetypes>
+class alignas(64) CommandBuffer
+{
+public:
+	// Object of the archetype with the given components set and the rest value-initialized. Its id isn't known
+	// until playback. Any order of the components of a storage archetype names it
+	template<typename TArchetype, typename... TComponents>
+	void Create(TComponents&&... values)
+	{
+		static_assert((std::same_as<typename TArchetype::Canonical, typename TArchetypes::Canonical> || ...), "Archetype is not part of the storage!");
+
+		auto& object = std::get<std::vector<typename TArchetype::Canonical::Tuple>>(m_creates).emplace_back();
+		((std::get<std::decay_t<TComponents>>(object) = std::forward<TComponents>(values)), ...);
+	}
+
+	void Delete(std::size_t objId)
+	{
+		m_deletes.push_back(objId);
+	}
+
+	// Moves the object to the archetype with the component added, or sets the component if it already has it
+	template<typename TComponent>
+	void AddComponent(std::size_t objId, TComponent value = {})
+	{
+		std::get<ComponentCommands<TComponent>>(m_componentCommands).Adds.push_back({ objId, m_sequence++, std::move(value) });
+	}
+
+	// Moves the object to the archetype without the component
+	template<typename TComponent>
+	void RemoveComponent(std::size_t objId)
+	{
+		std::get<ComponentCommands<TComponent>>(m_componentCommands).Removes.push_back({ objId, m_sequence++ });
+	}
+
+	bool IsEmpty() const
+	{
+		auto empty = m_deletes.empty();
+		std::apply([&empty](auto&... creates) { ((empty = empty && creates.empty()), ...); }, m_creates);
+		std::apply([&empty](auto&... commands) { ((empty = empty && commands.Adds.empty() && commands.Removes.empty()), ...); }, m_componentCommands);
+
+		return empty;
+	}
+
+	// Keeps the capacity, so a buffer reused every frame stops allocating
+	void Clear()
+	{
+		m_deletes.clear();
+		std::apply([](auto&... creates) { (creates.clear(), ...); }, m_creates);
+		std::apply([](auto&... commands) { ((commands.Adds.clear(), commands.Removes.clear()), ...); }, m_componentCommands);
+		m_sequence = 0;
+	}
+private:
+	template<typename... TArchs>
+	friend class EcsStorage;
+
+	// Adds and removes keep the order they were recorded in, playback folds an object's changes into one move
+	template<typename TComponent>
+	struct AddCommand
+	{
+		std::size_t ObjId;
+		std::size_t Sequence;
+		TComponent Value;
+	};
+
+	struct RemoveCommand
+	{
+		std::size_t ObjId;
+		std::size_t Sequence;
+	};
+
+	template<typename TComponent>
+	struct ComponentCommands
+	{
+		using Component = TComponent;
+
+		std::vector<AddCommand<TComponent>> Adds;
+		std::vector<RemoveCommand> Removes;
+	};
+
+	template<typename TComponents>
+	struct AllComponentCommands;
+
+	template<typename... TComponents>
+	struct AllComponentCommands<Archetype<TComponents...>>
+	{
+		using Type = std::tuple<ComponentCommands<TComponents>...>;
+	};
+
+	template<typename... TArchs>
+	struct ComponentUnion
+	{
+		using Type = EmptyArchetype;
+	};
+
+	template<typename TArch, typename... TArchs>
+	struct ComponentUnion<TArch, TArchs...>
+	{
+		using Type = TArch::template Union<typename ComponentUnion<TArchs...>::Type>;
+	};
+
+	// Every component of every archetype
+	using Components = ComponentUnion<TArchetypes...>::Type;
+
+	std::tuple<std::vector<typename TArchetypes::Canonical::Tuple>...> m_creates; // In the stores' component order
+	std::vector<std::size_t> m_deletes;
+	AllComponentCommands<Components>::Type m_componentCommands;
+	std::size_t m_sequence = 0;
+};
@@ -0,0 +1,463 @@
+#pragma once
+
+#include "PooledStore.h"
+#include "ParallelPooledStore.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// What storing a component takes without knowing its type, e.g. one declared by a script. Move constructs the
+// destination from the source, which is destroyed separately. Null operations treat the component as plain bytes,
+// zeroed on construction and copied on moves
+struct ComponentInfo
+{
+	std::string Name;
+	std::size_t Size;
+	std::size_t Alignment;
+	void (*Construct)(void *object) = nullptr;
+	void (*Move)(void *destination, void *source) = nullptr;
+	void (*Destroy)(void *object) = nullptr;
+};
+
+template<typename T>
+ComponentInfo MakeComponentInfo(std::string name = {})
+{
+	return {
+		std::move(name), sizeof(T), alignof(T),
+		[](void *object) { new(object) T(); },
+		[](void *destination, void *source) { new(destination) T(std::move(*static_cast<T *>(source))); },
+		[](void *object) { static_cast<T *>(object)->~T(); }
+	};
+}
+
+// Components known to the dynamic API, a component's id is its position. Only changed at sync points, like the
+// archetypes that use them
+class ComponentRegistry
+{
+public:
+	static inline constexpr std::size_t NO_COMPONENT = std::numeric_limits<std::size_t>::max();
+
+	// NO_COMPONENT if the name is taken or the component doesn't fit in a block
+	std::size_t Register(ComponentInfo info);
+
+	// Lets a component be found by name, e.g. one registered without a name by the storage
+	bool SetName(std::size_t componentId, std::string name);
+
+	std::size_t Find(std::string_view name) const;
+	const ComponentInfo& Get(std::size_t componentId) const;
+	std::size_t GetCount() const;
+private:
+	std::vector<ComponentInfo> m_components;
+	std::map<std::string, std::size_t, std::less<>> m_names;
+};
+
+inline std::size_t ComponentRegistry::Register(ComponentInfo info)
+{
+	if (info.Size == 0 || info.Size > MAX_BLOCK_SIZE || !std::has_single_bit(info.Alignment) || info.Alignment > BLOCK_SIZE)
+		return NO_COMPONENT;
+
+	if (!info.Name.empty() && !m_names.emplace(info.Name, m_components.size()).second)
+		return NO_COMPONENT;
+
+	m_components.push_back(std::move(info));
+	return m_components.size() - 1;
+}
+
+inline bool ComponentRegistry::SetName(std::size_t componentId, std::string name)
+{
+	if (componentId >= m_components.size() || !m_components[componentId].Name.empty() || !m_names.emplace(name, componentId).second)
+		return false;
+
+	m_components[componentId].Name = std::move(name);
+	return true;
+}
+
+inline std::size_t ComponentRegistry::Find(std::string_view name) const
+{
+	auto found = m_names.find(name);
+	return found == m_names.end() ? NO_COMPONENT : found->second;
+}
+
+inline const ComponentInfo& ComponentRegistry::Get(std::size_t componentId) const
+{
+	return m_components[componentId];
+}
+
+inline std::size_t ComponentRegistry::GetCount() const
+{
+	return m_components.size();
+}
+
+// A column of a component only known at runtime. Blocks come from the MemoryPool with the size and element count
+// a PooledStore of a type that size would use, elements are aligned by padding them to the alignment
+class DynamicColumn
+{
+public:
+	explicit DynamicColumn(const ComponentInfo& info);
+	~DynamicColumn();
+
+	DynamicColumn(DynamicColumn&& moved) noexcept;
+	DynamicColumn(const DynamicColumn&) = delete;
+	DynamicColumn& operator=(const DynamicColumn&) = delete;
+
+	// Appends an element and returns it unconstructed
+	void *Append();
+
+	// Destroys the element and moves the last one into its place
+	void SwapRemove(std::size_t index);
+
+	void *Get(std::size_t index);
+	void Construct(void *object) const;
+	void Move(void *destination, void *source) const;
+
+	std::size_t GetStride() const;
+	std::size_t GetPerBlock() const;
+private:
+	template<std::size_t Bytes>
+	struct RawBlock
+	{
+		std::byte Data[Bytes];
+	};
+
+	std::size_t m_size;
+	std::size_t m_stride;
+	std::size_t m_perBlock;
+	std::size_t m_sizeClass;
+	void (*m_construct)(void *);
+	void (*m_move)(void *, void *);
+	void (*m_destroy)(void *);
+
+	std::vector<std::byte *> m_blocks;
+	std::size_t m_count = 0;
+
+	static std::byte *RequestBlock(std::size_t sizeClass);
+	static void ReleaseBlock(std::byte *block, std::size_t sizeClass);
+};
+
+inline DynamicColumn::DynamicColumn(const ComponentInfo& info) :
+	m_size(info.Size), m_stride((info.Size + info.Alignment - 1) / info.Alignment * info.Alignment),
+	m_construct(info.Construct), m_move(info.Move), m_destroy(info.Destroy)
+{
+	auto blockBytes = GetBlockSizeFor(m_stride, MIN_T_PER_BLOCK);
+
+	m_perBlock = std::bit_floor(blockBytes / m_stride);
+	m_sizeClass = GetSizeClass(blockBytes);
+}
+
+inline DynamicColumn::~DynamicColumn()
+{
+	if (m_destroy)
+	{
+		for (std::size_t index = 0; index < m_count; ++index)
+			m_destroy(Get(index));
+	}
+
+	for (auto block : m_blocks)
+		ReleaseBlock(block, m_sizeClass);
+}
+
+inline DynamicColumn::DynamicColumn(DynamicColumn&& moved) noexcept :
+	m_size(moved.m_size), m_stride(moved.m_stride), m_perBlock(moved.m_perBlock), m_sizeClass(moved.m_sizeClass),
+	m_construct(moved.m_construct), m_move(moved.m_move), m_destroy(moved.m_destroy),
+	m_blocks(std::move(moved.m_blocks)), m_count(moved.m_count)
+{
+	moved.m_blocks.clear();
+	moved.m_count = 0;
+}
+
+inline void *DynamicColumn::Append()
+{
+	if (m_count == m_blocks.size() * m_perBlock)
+	{
+		m_blocks.push_back(RequestBlock(m_sizeClass));
+	}
+
+	return Get(m_count++);
+}
+
+inline void DynamicColumn::SwapRemove(std::size_t index)
+{
+	auto last = Get(m_count - 1);
+	auto removed = Get(index);
+
+	if (m_destroy)
+		m_destroy(removed);
+
+	if (removed != last)
+	{
+		Move(removed, last);
+
+		if (m_destroy)
+			m_destroy(last);
+	}
+
+	--m_count;
+
+	// Keeps one empty block, so an object created and deleted at the boundary doesn't bounce a block
+	if (m_blocks.size() * m_perBlock >= m_count + 2 * m_perBlock)
+	{
+		ReleaseBlock(m_blocks.back(), m_sizeClass);
+		m_blocks.pop_back();
+	}
+}
+
+inline void *DynamicColumn::Get(std::size_t index)
+{
+	// The per block count is a power of two, like a PooledStore's
+	return m_blocks[index / m_perBlock] + index % m_perBlock * m_stride;
+}
+
+inline void DynamicColumn::Construct(void *object) const
+{
+	if (m_construct)
+		m_construct(object);
+	else
+		std::memset(object, 0, m_size);
+}
+
+inline void DynamicColumn::Move(void *destination, void *source) const
+{
+	if (m_move)
+		m_move(destination, source);
+	else
+		std::memcpy(destination, source, m_size);
+}
+
+inline std::size_t DynamicColumn::GetStride() const
+{
+	return m_stride;
+}
+
+inline std::size_t DynamicColumn::GetPerBlock() const
+{
+	return m_perBlock;
+}
+
+inline std::byte *DynamicColumn::RequestBlock(std::size_t sizeClass)
+{
+	std::byte *block = nullptr;
+	[&]<std::size_t... Classes>(std::index_sequence<Classes...>)
+	{
+		((sizeClass == Classes ? void(block = MemoryPool::RequestBlock<RawBlock<BLOCK_SIZES[Classes]>>().Release()->Data) : void()), ...);
+	}(std::make_index_sequence<BLOCK_SIZE_CLASSES>());
+
+	return block;
+}
+
+inline void DynamicColumn::ReleaseBlock(std::byte *block, std::size_t sizeClass)
+{
+	// The pool pointer gives the block back when it goes out of scope
+	[&]<std::size_t... Classes>(std::index_sequence<Classes...>)
+	{
+		((sizeClass == Classes ? void(MemoryPool::Ptr<RawBlock<BLOCK_SIZES[Classes]>>(reinterpret_cast<RawBlock<BLOCK_SIZES[Classes]> *>(block))) : void()), ...);
+	}(std::make_index_sequence<BLOCK_SIZE_CLASSES>());
+}
+
+// A run of objects whose components are next to each other in every column of a dynamic query. Columns[i] is the
+// first object's component i of the query, Strides[i] the distance to the next object's
+struct DynamicChunk
+{
+	std::size_t Count;
+	const std::size_t *Ids;
+	std::span<std::byte *const> Columns;
+	std::span<const std::size_t> Strides;
+
+	template<typename T>
+	T& Get(std::size_t column, std::size_t index) const
+	{
+		return *reinterpret_cast<T *>(Columns[column] + index * Strides[column]);
+	}
+};
+
+// Objects of an archetype put together at runtime, a DynamicColumn per component. Ids are laid out like a
+// ParallelPooledStore's. The store is only changed at sync points, without views or RCU copies to wait for, so
+// deleted objects are filled right away by the last one
+class DynamicStore
+{
+public:
+	static inline constexpr std::size_t NO_INDEX = std::numeric_limits<std::size_t>::max();
+	static inline constexpr std::size_t NO_COLUMN = std::numeric_limits<std::size_t>::max();
+
+	// componentIds are sorted ids of the registry
+	DynamicStore(std::size_t archetypeIndex, std::vector<std::size_t> componentIds, const ComponentRegistry& registry);
+
+	std::span<const std::size_t> GetComponentIds() const;
+	std::size_t FindColumn(std::size_t componentId) const;
+
+	std::size_t GetIdPrefix() const;
+	std::size_t GetCount() const;
+	std::size_t GetId(std::size_t index) const;
+
+	// Index of a live object, NO_INDEX if the id is stale or from another archetype
+	std::size_t FindIndex(std::size_t id) const;
+
+	void *Get(std::size_t index, std::size_t column);
+	DynamicColumn& GetColumn(std::size_t column);
+
+	// New object, fill(column, object) may construct each component, e.g. from the object's previous archetype, and
+	// returns false for the ones to value-initialize. Returns the new id
+	template<typename TFill>
+	std::size_t Create(TFill&& fill);
+	std::size_t Create();
+
+	bool Delete(std::size_t id);
+
+	// Calls func with a DynamicChunk of the given columns for every run of objects that is contiguous in all of them
+	template<typename TFunc>
+	void ForEachChunk(std::span<const std::size_t> columns, TFunc& func);
+private:
+	std::size_t m_prefix;
+	std::vector<std::size_t> m_componentIds;
+	std::vector<DynamicColumn> m_columns;
+
+	std::vector<std::size_t> m_ids;     // Of the object at each index
+	std::vector<std::size_t> m_idMap;   // Generation and index of each id, NO_INDEX's id bits once deleted
+	std::vector<std::size_t> m_freeIds; // With their next generation
+};
+
+inline DynamicStore::DynamicStore(std::size_t archetypeIndex, std::vector<std::size_t> componentIds, const ComponentRegistry& registry) :
+	m_prefix(archetypeIndex << ARCHETYPE_ID_SHIFT | VALID_ID_BIT), m_componentIds(std::move(componentIds))
+{
+	m_columns.reserve(m_componentIds.size());
+	for (auto componentId : m_componentIds)
+		m_columns.emplace_back(registry.Get(componentId));
+}
+
+inline std::span<const std::size_t> DynamicStore::GetComponentIds() const
+{
+	return m_componentIds;
+}
+
+inline std::size_t DynamicStore::FindColumn(std::size_t componentId) const
+{
+	auto found = std::ranges::lower_bound(m_componentIds, componentId);
+	return found != m_componentIds.end() && *found == componentId ? found - m_componentIds.begin() : NO_COLUMN;
+}
+
+inline std::size_t DynamicStore::GetIdPrefix() const
+{
+	return m_prefix;
+}
+
+inline std::size_t DynamicStore::GetCount() const
+{
+	return m_ids.size();
+}
+
+inline std::size_t DynamicStore::GetId(std::size_t index) const
+{
+	return m_ids[index];
+}
+
+inline std::size_t DynamicStore::FindIndex(std::size_t id) const
+{
+	if ((id & ID_PREFIX_MASK) != m_prefix || (id & ID_MASK) >= m_idMap.size())
+		return NO_INDEX;
+
+	auto entry = m_idMap[id & ID_MASK];
+	if ((entry ^ id) & GENERATION_MASK || (entry & ID_MASK) == (NO_INDEX & ID_MASK))
+		return NO_INDEX;
+
+	return entry & ID_MASK;
+}
+
+inline void *DynamicStore::Get(std::size_t index, std::size_t column)
+{
+	return m_columns[column].Get(index);
+}
+
+inline DynamicColumn& DynamicStore::GetColumn(std::size_t column)
+{
+	return m_columns[column];
+}
+
+template<typename TFill>
+inline std::size_t DynamicStore::Create(TFill&& fill)
+{
+	std::size_t id;
+	if (m_freeIds.empty())
+	{
+		id = m_prefix | m_idMap.size();
+		m_idMap.emplace_back();
+	}
+	else
+	{
+		id = m_freeIds.back();
+		m_freeIds.pop_back();
+	}
+
+	auto index = m_ids.size();
+	m_ids.push_back(id);
+	m_idMap[id & ID_MASK] = (id & GENERATION_MASK) | index;
+
+	for (std::size_t column = 0; column < m_columns.size(); ++column)
+	{
+		auto object = m_columns[column].Append();
+		if (!fill(column, object))
+			m_columns[column].Construct(object);
+	}
+
+	return id;
+}
+
+inline std::size_t DynamicStore::Create()
+{
+	return Create([](std::size_t, void *) { return false; });
+}
+
+inline bool DynamicStore::Delete(std::size_t id)
+{
+	auto index = FindIndex(id);
+	if (index == NO_INDEX)
+		return false;
+
+	for (auto& column : m_columns)
+		column.SwapRemove(index);
+
+	// The last object took the hole
+	auto lastId = m_ids.back();
+	m_ids[index] = lastId;
+	m_idMap[lastId & ID_MASK] = (lastId & GENERATION_MASK) | index;
+	m_ids.pop_back();
+
+	auto freeId = GetNextGeneration(id);
+	m_idMap[id & ID_MASK] = (freeId & GENERATION_MASK) | (NO_INDEX & ID_MASK);
+	m_freeIds.push_back(freeId);
+
+	return true;
+}
+
+template<typename TFunc>
+inline void DynamicStore::ForEachChunk(std::span<const std::size_t> columns, TFunc& func)
+{
+	std::vector<std::byte *> pointers(columns.size());
+	std::vector<std::size_t> strides(columns.size());
+
+	for (std::size_t i = 0; i < columns.size(); ++i)
+		strides[i] = m_columns[columns[i]].GetStride();
+
+	for (std::size_t first = 0; first < m_ids.size();)
+	{
+		// Up to the nearest block end among the columns
+		auto last = m_ids.size();
+		for (std::size_t i = 0; i < columns.size(); ++i)
+		{
+			auto& column = m_columns[columns[i]];
+			pointers[i] = static_cast<std::byte *>(column.Get(first));
+			last = std::min(last, (first / column.GetPerBlock() + 1) * column.GetPerBlock());
+		}
+
+		func(DynamicChunk{ last - first, m_ids.data() + first, pointers, strides });
+		first = last;
+	}
+}
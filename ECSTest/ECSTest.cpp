@@ -2,6 +2,12 @@
 
 #include "EcsStorage.h"
 #include <unordered_set>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
 
 struct MyComponent
 {
@@ -16,6 +22,62 @@ struct MyComponent2
     std::size_t w;
 };
 
+// Same fields as MyComponent2, but stored as one column per field
+struct MySoaComponent
+{
+    std::size_t x;
+    std::size_t y;
+    std::size_t z;
+    std::size_t w;
+};
+
+template<>
+struct SoaLayout<MySoaComponent> : SoaFields<&MySoaComponent::x, &MySoaComponent::y, &MySoaComponent::z, &MySoaComponent::w> {};
+
+// Tag, only marks the archetype
+struct Selected
+{
+};
+
+// Tags that spread otherwise identical objects over many archetypes
+template<std::size_t Index>
+struct Variant
+{
+};
+
+// Packed into one bit per object
+struct Visible : BoolComponent
+{
+};
+
+// What a flag had to look like before packed components
+struct PaddedVisible
+{
+    std::size_t Value;
+};
+
+// Added to objects that get hit, moves them to another archetype
+struct Burning
+{
+    std::size_t Ticks;
+};
+
+struct Position
+{
+    std::uint32_t x;
+    std::uint32_t y;
+};
+
+// Points at the object owning this one
+struct Owner : Relation
+{
+};
+
+// Points at the parent node of a transform tree
+struct Parent : Relation
+{
+};
+
 void test()
 {
     using Simple = Archetype<MyComponent, MyComponent2>;
@@ -49,6 +111,19 @@ void test()
     }
     clock_t endUpdate = clock();
 
+    // Nothing else touches the store here, so blocks can be written in place instead of copied
+    std::size_t exclusiveCount = 0;
+    clock_t startExclusiveUpdate = clock();
+    for (auto [id, myComp, myComp2] : storage.RunQueryExclusive<SimpleWriteQuery>())
+    {
+        myComp.x = exclusiveCount;
+        myComp2.x = exclusiveCount;
+        ++exclusiveCount;
+    }
+    clock_t endExclusiveUpdate = clock();
+
+    auto epochStats = EpochReclaimer::GetStats();
+
     clock_t startDelete = clock();
     for (auto [id] : storage.RunQuery<Query::Read<std::size_t>>())
     {
@@ -60,6 +135,7 @@ void test()
     auto createTime = static_cast<double>(endCreate - startCreate) / CLOCKS_PER_SEC * 1000.0;
     auto deleteTime = static_cast<double>(endDelete - startDelete) / CLOCKS_PER_SEC * 1000.0;
     auto updateTime = static_cast<double>(endUpdate - startUpdate) / CLOCKS_PER_SEC * 1000.0;
+    auto exclusiveUpdateTime = static_cast<double>(endExclusiveUpdate - startExclusiveUpdate) / CLOCKS_PER_SEC * 1000.0;
     auto readTime = static_cast<double>(endRead - startRead) / CLOCKS_PER_SEC * 1000.0;
 
     std::cout 
@@ -67,16 +143,1020 @@ void test()
         << "Create " << createTime 
         << "ms Read " << updateTime 
         << "ms Update " << updateTime  
+        << "ms Exclusive update " << exclusiveUpdateTime
         << "ms Delete " << deleteTime
+        << "ms" << std::endl
+        << "Retired blocks pending " << epochStats.PendingBlocks
+        << " reclaimed " << epochStats.ReclaimedBlocks << std::endl;
+}
+
+struct PoolBenchBlock
+{
+    std::size_t data[BLOCK_SIZE / sizeof(std::size_t)];
+};
+
+void benchPoolAllocation()
+{
+    const std::size_t allocationsPerThread = 1000000;
+    const std::size_t batchSize = 32; // Simulates a writer holding a few RCU blocks at once
+
+    const std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (std::size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+    {
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&]()
+            {
+                std::vector<MemoryPool::Ptr<PoolBenchBlock>> held(batchSize);
+                for (std::size_t i = 0; i < allocationsPerThread; i += batchSize)
+                {
+                    for (auto& ptr : held)
+                        ptr = MemoryPool::RequestBlock<PoolBenchBlock>();
+                    for (auto& ptr : held)
+                        ptr = MemoryPool::Ptr<PoolBenchBlock>();
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+        auto end = std::chrono::steady_clock::now();
+
+        auto time = std::chrono::duration<double, std::milli>(end - start).count();
+        auto throughput = static_cast<double>(allocationsPerThread * threadCount) / time / 1000.0;
+
+        std::cout
+            << "Pool threads " << threadCount
+            << " Time " << time
+            << "ms Throughput " << throughput
+            << "M alloc/free per second" << std::endl;
+    }
+}
+
+void benchNumaAllocation()
+{
+    const std::size_t allocationsPerThread = 1000000;
+    const std::size_t batchSize = 32;
+
+    const std::size_t nodeCount = MemoryPool::GetNodeCount();
+    const std::size_t threadCount = std::max<std::size_t>(std::thread::hardware_concurrency(), nodeCount);
+
+    std::atomic_size_t localBlocks = 0;
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            MemoryPool::SetThreadNode(t % nodeCount);
+
+            std::size_t local = 0;
+            std::vector<MemoryPool::Ptr<PoolBenchBlock>> held(batchSize);
+            for (std::size_t i = 0; i < allocationsPerThread; i += batchSize)
+            {
+                for (auto& ptr : held)
+                {
+                    ptr = MemoryPool::RequestBlock<PoolBenchBlock>();
+                    local += MemoryPool::GetBlockNode(ptr.Load()) == MemoryPool::GetCurrentNode();
+                }
+                for (auto& ptr : held)
+                    ptr = MemoryPool::Ptr<PoolBenchBlock>();
+            }
+
+            localBlocks += local;
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    auto time = std::chrono::duration<double, std::milli>(end - start).count();
+    auto stats = MemoryPool::GetStats();
+
+    // A node-oblivious pool spreads blocks evenly, so (N - 1) / N of them would be remote
+    auto totalBlocks = allocationsPerThread / batchSize * batchSize * threadCount;
+    auto avoidedBytes = static_cast<double>(localBlocks) * (nodeCount - 1) / nodeCount * BLOCK_SIZE;
+
+    std::cout
+        << "NUMA nodes " << nodeCount
+        << " Threads " << threadCount
+        << " Time " << time
+        << "ms Local " << localBlocks << "/" << totalBlocks
+        << " Refilled local " << stats.LocalBlocks
+        << " remote " << stats.RemoteBlocks
+        << " Cross-node traffic avoided " << avoidedBytes / (1024.0 * 1024.0)
+        << "MB" << std::endl;
+}
+
+void benchChangedQuery()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using ChangedQuery = Query::Read<MyComponent2>::Changed<MyComponent2>;
+
+    const std::size_t objectCount = 1000000;
+    const std::size_t churnStride = 10000; // Touch 0.01% of objects per frame
+
+    EcsStorage<Simple> storage;
+    for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+    {
+        myComp2.x = 0;
+    }
+
+    auto lastSeen = storage.AdvanceChangeVersion();
+
+    // Sparse writes, only the touched blocks get copied and stamped
+    std::size_t index = 0;
+    auto writeView = storage.RunQuery<Query::Write<MyComponent2>>();
+    for (auto cur = writeView.begin(); cur != writeView.end(); ++cur, ++index)
+    {
+        if (index % churnStride == 0)
+            std::get<MyComponent2&>(*cur).x += 1;
+    }
+
+    std::size_t fullCount = 0;
+    auto startFull = std::chrono::steady_clock::now();
+    for (auto [myComp2] : storage.RunQuery<Query::Read<MyComponent2>>())
+    {
+        fullCount += myComp2.x;
+    }
+    auto endFull = std::chrono::steady_clock::now();
+
+    std::size_t changedCount = 0;
+    std::size_t visited = 0;
+    auto startChanged = std::chrono::steady_clock::now();
+    for (auto [myComp2] : storage.RunQuerySince<ChangedQuery>(lastSeen))
+    {
+        changedCount += myComp2.x;
+        ++visited;
+    }
+    auto endChanged = std::chrono::steady_clock::now();
+
+    std::cout
+        << "Changed query found " << changedCount << "/" << fullCount
+        << " writes visiting " << visited << "/" << objectCount
+        << " objects, Full scan " << std::chrono::duration<double, std::milli>(endFull - startFull).count()
+        << "ms Changed scan " << std::chrono::duration<double, std::milli>(endChanged - startChanged).count()
+        << "ms" << std::endl;
+}
+
+void benchChunkedQuery()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using UpdateQuery = Query::Read<MyComponent>::Write<MyComponent2>;
+
+    const std::size_t objectCount = 2000000;
+
+    EcsStorage<Simple> storage;
+    for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+    {
+        myComp.x = 3;
+        myComp2.x = 0;
+    }
+
+    auto startElement = std::chrono::steady_clock::now();
+    for (auto [myComp, myComp2] : storage.RunQueryExclusive<UpdateQuery>())
+    {
+        myComp2.x += myComp.x;
+    }
+    auto endElement = std::chrono::steady_clock::now();
+
+    auto startChunked = std::chrono::steady_clock::now();
+    for (auto chunk : storage.RunQueryChunkedExclusive<UpdateQuery>())
+    {
+        auto [myComps, myComp2s] = chunk.Spans;
+
+        // No per-object branches, so this loop is left to the compiler's vectorizer
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            myComp2s[i].x += myComps[i].x;
+    }
+    auto endChunked = std::chrono::steady_clock::now();
+
+    std::size_t sum = 0;
+    for (auto chunk : storage.RunQueryChunked<Query::Read<MyComponent2>>())
+    {
+        auto [myComp2s] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            sum += myComp2s[i].x;
+    }
+
+    std::cout
+        << "Per-object update " << std::chrono::duration<double, std::milli>(endElement - startElement).count()
+        << "ms Chunked update " << std::chrono::duration<double, std::milli>(endChunked - startChunked).count()
+        << "ms Checksum " << sum << "/" << objectCount * 6 << std::endl;
+}
+
+void benchSoaQuery()
+{
+    using Aos = Archetype<MyComponent2>;
+    using Soa = Archetype<MySoaComponent>;
+
+    const std::size_t objectCount = 2000000;
+
+    EcsStorage<Aos> aosStorage;
+    for (auto [id, myComp2] : aosStorage.Create<Aos>(objectCount))
+    {
+        myComp2.x = 1;
+    }
+
+    EcsStorage<Soa> soaStorage;
+    for (auto [id, soaComp] : soaStorage.Create<Soa>(objectCount))
+    {
+        soaComp = MySoaComponent{ 1, 2, 3, 4 };
+    }
+
+    // Both layouts scan only x, the SoA one reads a quarter of the memory to do it
+    std::size_t aosSum = 0;
+    auto startAos = std::chrono::steady_clock::now();
+    for (auto chunk : aosStorage.RunQueryChunked<Query::Read<MyComponent2>>())
+    {
+        auto [myComp2s] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            aosSum += myComp2s[i].x;
+    }
+    auto endAos = std::chrono::steady_clock::now();
+
+    std::size_t soaSum = 0;
+    auto startSoa = std::chrono::steady_clock::now();
+    for (auto chunk : soaStorage.RunQueryChunked<Query::Read<MySoaComponent>>())
+    {
+        auto [soaComps] = chunk.Spans;
+        auto xs = soaComps.Get<&MySoaComponent::x>();
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            soaSum += xs[i];
+    }
+    auto endSoa = std::chrono::steady_clock::now();
+
+    // Per-object access goes through a proxy that reaches single fields without gathering the whole component
+    std::size_t proxySum = 0;
+    auto startProxy = std::chrono::steady_clock::now();
+    for (auto [soaComp] : soaStorage.RunQuery<Query::Read<MySoaComponent>>())
+    {
+        proxySum += soaComp.Get<&MySoaComponent::x>();
+    }
+    auto endProxy = std::chrono::steady_clock::now();
+
+    std::size_t gatherSum = 0;
+    for (auto [soaComp] : soaStorage.RunQuery<Query::Read<MySoaComponent>>())
+    {
+        MySoaComponent value = soaComp;
+        gatherSum += value.x + value.y + value.z + value.w;
+    }
+
+    std::cout
+        << "AoS chunked scan " << std::chrono::duration<double, std::milli>(endAos - startAos).count()
+        << "ms SoA chunked scan " << std::chrono::duration<double, std::milli>(endSoa - startSoa).count()
+        << "ms SoA per-object scan " << std::chrono::duration<double, std::milli>(endProxy - startProxy).count()
+        << "ms Checksum " << aosSum << "/" << soaSum << "/" << proxySum << "/" << gatherSum / 10 << std::endl;
+}
+
+void benchFlagComponents()
+{
+    using Packed = Archetype<MyComponent, Selected, Visible>;
+    using Padded = Archetype<MyComponent, PaddedVisible>;
+
+    const std::size_t objectCount = 2000000;
+
+    EcsStorage<Packed, Padded> storage;
+    for (auto [id, myComp, selected, visible] : storage.Create<Packed>(objectCount))
+    {
+        visible = (id & ID_MASK) % 3 == 0;
+    }
+    for (auto [id, myComp, visible] : storage.Create<Padded>(objectCount))
+    {
+        visible.Value = (id & ID_MASK) % 3 == 0;
+    }
+
+    std::size_t paddedCount = 0;
+    auto startPadded = std::chrono::steady_clock::now();
+    for (auto chunk : storage.RunQueryChunked<Query::Read<PaddedVisible>>())
+    {
+        auto [visibles] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            paddedCount += visibles[i].Value;
+    }
+    auto endPadded = std::chrono::steady_clock::now();
+
+    // 64 flags per load, deleted objects are masked out with the chunk's live mask
+    std::size_t packedCount = 0;
+    auto startPacked = std::chrono::steady_clock::now();
+    for (auto chunk : storage.RunQueryChunked<Query::Read<Visible>>())
+    {
+        auto [visibles] = chunk.Spans;
+        for (std::size_t word = 0; word * 64 < chunk.Count; ++word)
+            packedCount += std::popcount(visibles.GetWord(word) & chunk.GetLiveMask(word));
+    }
+    auto endPacked = std::chrono::steady_clock::now();
+
+    std::size_t selectedCount = 0;
+    for (auto [myComp, selected] : storage.RunQuery<Query::Read<MyComponent, Selected>>())
+    {
+        ++selectedCount;
+    }
+
+    std::size_t unselectedCount = 0;
+    for (auto [myComp] : storage.RunQuery<Query::Read<MyComponent>::Exclude<Selected>>())
+    {
+        ++unselectedCount;
+    }
+
+    std::cout
+        << "Padded flag scan " << std::chrono::duration<double, std::milli>(endPadded - startPadded).count()
+        << "ms Packed flag scan " << std::chrono::duration<double, std::milli>(endPacked - startPacked).count()
+        << "ms Visible " << paddedCount << "/" << packedCount
+        << " Selected " << selectedCount << " Unselected " << unselectedCount << std::endl;
+}
+
+void benchSparseBitset()
+{
+    const std::size_t bitCount = 64 * 1024 * 1024;
+    const std::size_t oneStride = 1000000; // A handful of deleted objects in a huge store
+
+    AtomicBitset bits;
+    bits.GrowBitsTo(bitCount);
+    for (std::size_t i = oneStride / 2; i < bitCount; i += oneStride)
+        bits.Set(i, true);
+
+    // Summary bits let the search skip empty words and blocks instead of loading every word
+    std::size_t found = 0;
+    auto startOnes = std::chrono::steady_clock::now();
+    for (auto cur = bits.ReadonlyBegin(); cur != bits.ReadonlyEnd(); ++cur)
+    {
+        ++found;
+    }
+    auto endOnes = std::chrono::steady_clock::now();
+
+    std::size_t wordFound = 0;
+    auto startWords = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < bitCount; i += 64)
+    {
+        wordFound += std::popcount(bits.GetWord(i));
+    }
+    auto endWords = std::chrono::steady_clock::now();
+
+    std::cout
+        << "Sparse ones found " << found << "/" << wordFound
+        << " Summary scan " << std::chrono::duration<double, std::milli>(endOnes - startOnes).count()
+        << "ms Word scan " << std::chrono::duration<double, std::milli>(endWords - startWords).count()
+        << "ms" << std::endl;
+}
+
+void benchBulkDelete()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using IdQuery = Query::Read<std::size_t>;
+    const std::size_t objectCount = 2000000;
+
+    auto createStorage = [&](EcsStorage<Simple>& storage)
+    {
+        for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+        {
+            myComp.x = id & ID_MASK;
+        }
+    };
+
+    std::vector<std::size_t> ids;
+    ids.reserve(objectCount);
+
+    // One id at a time, what test() measures
+    double singleTime;
+    {
+        EcsStorage<Simple> storage;
+        createStorage(storage);
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto [id] : storage.RunQuery<IdQuery>())
+        {
+            storage.Delete<Simple>(id);
+        }
+        singleTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double manyTime;
+    {
+        EcsStorage<Simple> storage;
+        createStorage(storage);
+
+        for (auto [id] : storage.RunQuery<IdQuery>())
+        {
+            ids.push_back(id);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        storage.DeleteMany<Simple>(ids);
+        manyTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double rangeTime;
+    {
+        EcsStorage<Simple> storage;
+        auto created = storage.Create<Simple>(objectCount);
+
+        auto start = std::chrono::steady_clock::now();
+        storage.DeleteRange<Simple>(created);
+        rangeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Despawns every other object
+    std::size_t whereDeleted;
+    double whereTime;
+    {
+        EcsStorage<Simple> storage;
+        createStorage(storage);
+
+        auto start = std::chrono::steady_clock::now();
+        whereDeleted = storage.DeleteWhere<Query::Read<MyComponent>>([](const MyComponent& myComp) { return myComp.x % 2 == 0; });
+        whereTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::cout
+        << "Delete " << objectCount << " single " << singleTime
+        << "ms DeleteMany " << manyTime
+        << "ms DeleteRange " << rangeTime
+        << "ms DeleteWhere (" << whereDeleted << ") " << whereTime
         << "ms" << std::endl;
 }
 
+void benchCompaction()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    const std::size_t objectCount = 2000000;
+
+    // Despawn every other object, the worst case for compaction as half the store has to move
+    auto fragment = [&](EcsStorage<Simple>& storage)
+    {
+        for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+        {
+            myComp.x = id & ID_MASK;
+        }
+
+        std::vector<std::size_t> ids;
+        for (auto [id] : storage.RunQuery<Query::Read<std::size_t>>())
+        {
+            if ((id & ID_MASK) % 2 == 0)
+                ids.push_back(id);
+        }
+
+        storage.DeleteMany<Simple>(ids);
+    };
+
+    // Everything in one go, what releasing the last view used to do
+    EcsStorage<Simple> fullStorage;
+    fullStorage.SetCompactionBudget({ .MaxTime = std::chrono::microseconds::max() });
+    fragment(fullStorage);
+
+    auto fragmentation = fullStorage.GetFragmentationStats<Simple>().Fragmentation;
+
+    auto startFull = std::chrono::steady_clock::now();
+    fullStorage.Compact({ .MaxTime = std::chrono::microseconds::max() });
+    auto endFull = std::chrono::steady_clock::now();
+
+    // Slices of at most 1ms, e.g. one per frame, with views free to open in between
+    EcsStorage<Simple> slicedStorage;
+    slicedStorage.SetCompactionBudget({ .MaxMoves = 0 });
+    fragment(slicedStorage);
+
+    while (!slicedStorage.Compact({ .MaxTime = std::chrono::milliseconds(1) }))
+    {
+        std::size_t visited = 0;
+        for (auto [id] : slicedStorage.RunQuery<Query::Read<std::size_t>>())
+        {
+            ++visited;
+        }
+    }
+
+    auto slicedStats = slicedStorage.GetFragmentationStats<Simple>();
+
+    std::cout
+        << "Compaction of " << fragmentation * 100.0 << "% deleted, Stop-the-world "
+        << std::chrono::duration<double, std::milli>(endFull - startFull).count()
+        << "ms Sliced " << slicedStats.SliceCount << " slices max " << slicedStats.MaxSliceTime.count()
+        << "us moved " << slicedStats.MovedCount << " left " << slicedStats.Fragmentation * 100.0
+        << "%" << std::endl;
+}
+
+void benchParallelQuery()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using UpdateQuery = Query::Read<MyComponent>::Write<MyComponent2>;
+
+    const std::size_t objectCount = 4000000;
+    const std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    EcsStorage<Simple> storage;
+    for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+    {
+        myComp.x = 3;
+        myComp2.x = 0;
+    }
+
+    std::size_t rounds = 0;
+    for (std::size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+    {
+        ThreadPool pool(threadCount);
+
+        auto startElement = std::chrono::steady_clock::now();
+        storage.RunQueryParallel<UpdateQuery>([](const MyComponent& myComp, MyComponent2& myComp2)
+        {
+            myComp2.x += myComp.x;
+        }, pool);
+        auto endElement = std::chrono::steady_clock::now();
+
+        auto startChunked = std::chrono::steady_clock::now();
+        storage.ParallelForEachChunk<UpdateQuery>([](auto& chunk)
+        {
+            auto [myComps, myComp2s] = chunk.Spans;
+            for (std::size_t i = 0; i < chunk.Count; ++i)
+                myComp2s[i].x += myComps[i].x;
+        }, pool);
+        auto endChunked = std::chrono::steady_clock::now();
+
+        rounds += 2;
+
+        std::cout
+            << "Parallel threads " << threadCount
+            << " Per-object update " << std::chrono::duration<double, std::milli>(endElement - startElement).count()
+            << "ms Chunked update " << std::chrono::duration<double, std::milli>(endChunked - startChunked).count()
+            << "ms" << std::endl;
+    }
+
+    std::size_t sum = 0;
+    for (auto chunk : storage.RunQueryChunked<Query::Read<MyComponent2>>())
+    {
+        auto [myComp2s] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            sum += myComp2s[i].x;
+    }
+
+    std::cout << "Parallel checksum " << sum << "/" << objectCount * 3 * rounds << std::endl;
+}
+
+void benchMortonSort()
+{
+    using Spatial = Archetype<Position, MyComponent2>;
+
+    const std::uint32_t gridSize = 1024;
+    const std::size_t blocksPerFrame = 16;
+
+    // Every cell holds one object, created in shuffled order
+    std::vector<std::uint32_t> cells(gridSize * gridSize);
+    for (std::uint32_t cell = 0; cell < cells.size(); ++cell)
+        cells[cell] = cell;
+
+    std::mt19937 rng(1);
+    std::shuffle(cells.begin(), cells.end(), rng);
+
+    EcsStorage<Spatial> storage;
+    std::vector<std::size_t> cellIds(cells.size());
+
+    auto cell = cells.begin();
+    for (auto [id, position, myComp2] : storage.Create<Spatial>(cells.size()))
+    {
+        position.x = *cell % gridSize;
+        position.y = *cell / gridSize;
+        myComp2.x = 1;
+        cellIds[*cell++] = id;
+    }
+
+    // Walks the grid tile by tile like a neighbourhood query would
+    auto scanTiles = [&]()
+    {
+        const std::uint32_t tileSize = 16;
+        std::size_t sum = 0;
+
+        for (std::uint32_t tileY = 0; tileY < gridSize; tileY += tileSize)
+            for (std::uint32_t tileX = 0; tileX < gridSize; tileX += tileSize)
+                for (std::uint32_t y = tileY; y < tileY + tileSize; ++y)
+                    for (std::uint32_t x = tileX; x < tileX + tileSize; ++x)
+                        if (auto object = storage.TryGet<Spatial, MyComponent2>(cellIds[y * gridSize + x]))
+                            sum += std::get<0>(*object).x;
+
+        return sum;
+    };
+
+    auto startShuffled = std::chrono::steady_clock::now();
+    auto shuffledSum = scanTiles();
+    auto endShuffled = std::chrono::steady_clock::now();
+
+    auto mortonKey = [](const Position& position) { return GetMortonKey(position.x, position.y); };
+
+    std::size_t frames = 1;
+    auto startSort = std::chrono::steady_clock::now();
+    while (!storage.SortBy<Spatial, Position>(mortonKey, blocksPerFrame))
+        ++frames;
+    auto endSort = std::chrono::steady_clock::now();
+
+    auto startSorted = std::chrono::steady_clock::now();
+    auto sortedSum = scanTiles();
+    auto endSorted = std::chrono::steady_clock::now();
+
+    std::cout
+        << "Tile scan shuffled " << std::chrono::duration<double, std::milli>(endShuffled - startShuffled).count()
+        << "ms Morton ordered " << std::chrono::duration<double, std::milli>(endSorted - startSorted).count()
+        << "ms Sort " << std::chrono::duration<double, std::milli>(endSort - startSort).count()
+        << "ms over " << frames << " frames Checksum " << shuffledSum << "/" << sortedSum << std::endl;
+}
+
+void benchCommandBuffer()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using CheckQuery = Query::Read<std::size_t, MyComponent>;
+
+    const std::size_t objectCount = 2000000;
+    auto& pool = ThreadPool::GetShared();
+
+    EcsStorage<Simple> directStorage;
+    EcsStorage<Simple> deferredStorage;
+
+    for (auto [id, myComp, myComp2] : directStorage.Create<Simple>(objectCount))
+        myComp.x = id & ID_MASK;
+
+    for (auto [id, myComp, myComp2] : deferredStorage.Create<Simple>(objectCount))
+        myComp.x = id & ID_MASK;
+
+    // Every worker deletes straight from the query, contending on the store's deleted bits
+    auto startDirect = std::chrono::steady_clock::now();
+    directStorage.RunQueryParallel<CheckQuery>([&](std::size_t id, const MyComponent& myComp)
+    {
+        if (myComp.x % 4 == 0)
+            directStorage.Delete<Simple>(id);
+    }, pool);
+    auto endDirect = std::chrono::steady_clock::now();
+
+    // Every worker records into its own buffer, played back in one batch after the query
+    std::vector<EcsStorage<Simple>::CommandBufferType> buffers(pool.GetThreadCount());
+
+    auto startRecord = std::chrono::steady_clock::now();
+    deferredStorage.RunQueryParallel<CheckQuery>([&](std::size_t id, const MyComponent& myComp)
+    {
+        if (myComp.x % 4 == 0)
+            buffers[ThreadPool::GetCurrentThreadIndex()].Delete(id);
+    }, pool);
+    auto endRecord = std::chrono::steady_clock::now();
+
+    auto startPlayback = std::chrono::steady_clock::now();
+    deferredStorage.Playback(buffers);
+    auto endPlayback = std::chrono::steady_clock::now();
+
+    std::size_t directCount = 0;
+    for (auto [id] : directStorage.RunQuery<Query::Read<std::size_t>>())
+        ++directCount;
+
+    std::size_t deferredCount = 0;
+    for (auto [id] : deferredStorage.RunQuery<Query::Read<std::size_t>>())
+        ++deferredCount;
+
+    std::cout
+        << "Deletes from " << pool.GetThreadCount() << " threads, Direct " << std::chrono::duration<double, std::milli>(endDirect - startDirect).count()
+        << "ms Recorded " << std::chrono::duration<double, std::milli>(endRecord - startRecord).count()
+        << "ms Playback " << std::chrono::duration<double, std::milli>(endPlayback - startPlayback).count()
+        << "ms Left " << directCount << "/" << deferredCount << std::endl;
+}
+
+void benchMigration()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using SimpleBurning = Archetype<MyComponent, MyComponent2, Burning>;
+
+    const std::size_t objectCount = 1000000;
+
+    EcsStorage<Simple, SimpleBurning> perObjectStorage;
+    EcsStorage<Simple, SimpleBurning> batchedStorage;
+
+    // A quarter of the objects get hit this frame
+    std::vector<std::size_t> perObjectHits;
+    for (auto [id, myComp, myComp2] : perObjectStorage.Create<Simple>(objectCount))
+    {
+        myComp.x = 1;
+        if ((id & ID_MASK) % 4 == 0)
+            perObjectHits.push_back(id);
+    }
+
+    std::vector<std::size_t> batchedHits;
+    for (auto [id, myComp, myComp2] : batchedStorage.Create<Simple>(objectCount))
+    {
+        myComp.x = 1;
+        if ((id & ID_MASK) % 4 == 0)
+            batchedHits.push_back(id);
+    }
+
+    auto startPerObject = std::chrono::steady_clock::now();
+    for (auto id : perObjectHits)
+        perObjectStorage.AddComponent<Burning>(id, { 3 });
+    auto endPerObject = std::chrono::steady_clock::now();
+
+    auto startBatched = std::chrono::steady_clock::now();
+    batchedStorage.AddComponents<Burning>(batchedHits, { 3 });
+    auto endBatched = std::chrono::steady_clock::now();
+
+    auto countBurning = [](auto& storage)
+    {
+        std::size_t sum = 0;
+        for (auto [myComp, burning] : storage.template RunQuery<Query::Read<MyComponent, Burning>>())
+            sum += myComp.x * burning.Ticks;
+
+        return sum;
+    };
+
+    std::cout
+        << "Migration of " << batchedHits.size() << " objects, Per-object " << std::chrono::duration<double, std::milli>(endPerObject - startPerObject).count()
+        << "ms Batched " << std::chrono::duration<double, std::milli>(endBatched - startBatched).count()
+        << "ms Checksum " << countBurning(perObjectStorage) << "/" << countBurning(batchedStorage) << std::endl;
+}
+
+void benchJoin()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+    using Owned = Archetype<MyComponent, Owner>;
+
+    const std::size_t ownerCount = 10000;
+    const std::size_t ownedCount = 200000;
+
+    EcsStorage<Simple, Owned> storage;
+
+    std::vector<std::size_t> owners;
+    for (auto [id, myComp, myComp2] : storage.Create<Simple>(ownerCount))
+    {
+        myComp.x = 1;
+        owners.push_back(id);
+    }
+
+    std::mt19937_64 random(7);
+    for (auto [id, myComp, owner] : storage.Create<Owned>(ownedCount))
+    {
+        myComp.x = 0;
+        owner.Target = owners[random() % ownerCount];
+    }
+
+    auto startNested = std::chrono::steady_clock::now();
+    for (auto [myComp, owner] : storage.RunQuery<Query::Write<MyComponent>::Read<Owner>>())
+    {
+        for (auto [ownerComp] : storage.RunQuery<Query::Read<MyComponent>>(owner.Target))
+            myComp.x += ownerComp.x;
+    }
+    auto endNested = std::chrono::steady_clock::now();
+
+    auto startJoin = std::chrono::steady_clock::now();
+    for (auto [myComp, ownerComp] : storage.RunQuery<Query::Write<MyComponent>::Join<Owner>::Read<MyComponent>>())
+        myComp.x += ownerComp.x;
+    auto endJoin = std::chrono::steady_clock::now();
+
+    std::size_t sum = 0;
+    for (auto [myComp, owner] : storage.RunQuery<Query::Read<MyComponent, Owner>>())
+        sum += myComp.x;
+
+    std::cout
+        << "Join of " << ownedCount << " objects to " << ownerCount << " owners, Nested GetViewAt " << std::chrono::duration<double, std::milli>(endNested - startNested).count()
+        << "ms Join " << std::chrono::duration<double, std::milli>(endJoin - startJoin).count() << "ms Checksum " << sum << std::endl;
+}
+
+void benchHierarchy()
+{
+    using Root = Archetype<MyComponent, MyComponent2>;
+    using Node = Archetype<MyComponent, MyComponent2, Parent>;
+
+    const std::size_t rootCount = 1000;
+    const std::size_t nodesPerLevel = 50000;
+    const std::size_t levelCount = 8;
+
+    EcsStorage<Root, Node> storage;
+
+    // MyComponent is the world value, MyComponent2::x the local one added to the parent's
+    std::vector<std::size_t> roots;
+    for (auto [id, world, local] : storage.Create<Root>(rootCount))
+    {
+        world.x = 1;
+        local.x = 1;
+        roots.push_back(id);
+    }
+
+    std::mt19937_64 random(11);
+    std::vector<std::size_t> previousLevel = roots;
+    for (std::size_t level = 0; level < levelCount; ++level)
+    {
+        std::vector<std::size_t> currentLevel;
+        for (auto [id, world, local, parent] : storage.Create<Node>(nodesPerLevel))
+        {
+            world.x = 0;
+            local.x = 1;
+            parent.Target = previousLevel[random() % previousLevel.size()];
+            currentLevel.push_back(id);
+        }
+
+        previousLevel = std::move(currentLevel);
+    }
+
+    // Children lists gathered each frame, then a depth first walk fetching every child by id
+    auto startRecursive = std::chrono::steady_clock::now();
+    std::unordered_map<std::size_t, std::vector<std::size_t>> children;
+    for (auto [id, parent] : storage.RunQuery<Query::Read<std::size_t, Parent>>())
+        children[parent.Target].push_back(id);
+
+    auto propagate = [&storage, &children](auto& self, std::size_t parentId, std::size_t parentWorld) -> void
+    {
+        auto found = children.find(parentId);
+        if (found == children.end())
+            return;
+
+        for (auto childId : found->second)
+        {
+            std::size_t childWorld = 0;
+            for (auto [world, local] : storage.RunQuery<Query::Write<MyComponent>::Read<MyComponent2>>(childId))
+                childWorld = world.x = parentWorld + local.x;
+
+            self(self, childId, childWorld);
+        }
+    };
+
+    for (auto rootId : roots)
+        propagate(propagate, rootId, 1);
+    auto endRecursive = std::chrono::steady_clock::now();
+
+    using Traverse = Query::Write<MyComponent>::Read<MyComponent2>::Join<Parent>::Read<MyComponent>::LevelTraverse<Parent>;
+    auto update = [](MyComponent& world, const MyComponent2& local, const MyComponent& parentWorld) { world.x = parentWorld.x + local.x; };
+
+    // The first frame builds the levels, later ones reuse them
+    auto startFirst = std::chrono::steady_clock::now();
+    storage.RunQueryParallel<Traverse>(update);
+    auto endFirst = std::chrono::steady_clock::now();
+
+    const std::size_t frameCount = 5;
+
+    auto startSteady = std::chrono::steady_clock::now();
+    for (std::size_t frame = 0; frame < frameCount; ++frame)
+    {
+        storage.AdvanceChangeVersion();
+        storage.RunQueryParallel<Traverse>(update);
+    }
+    auto endSteady = std::chrono::steady_clock::now();
+
+    std::size_t sum = 0;
+    for (auto [world, parent] : storage.RunQuery<Query::Read<MyComponent, Parent>>())
+        sum += world.x;
+
+    std::cout
+        << "Hierarchy of " << nodesPerLevel * levelCount << " nodes, Recursive " << std::chrono::duration<double, std::milli>(endRecursive - startRecursive).count()
+        << "ms LevelTraverse first " << std::chrono::duration<double, std::milli>(endFirst - startFirst).count()
+        << "ms steady " << std::chrono::duration<double, std::milli>(endSteady - startSteady).count() / frameCount << "ms Checksum " << sum << std::endl;
+}
+
+void benchManyArchetypes()
+{
+    const std::size_t archetypeCount = 20;
+    const std::size_t objectsPerArchetype = 50000;
+
+    using Storage = decltype([]<std::size_t... Indices>(std::index_sequence<Indices...>)
+    {
+        return EcsStorage<Archetype<MyComponent, MyComponent2, Variant<Indices>>...>();
+    }(std::make_index_sequence<archetypeCount>()));
+
+    Storage storage;
+    [&storage]<std::size_t... Indices>(std::index_sequence<Indices...>)
+    {
+        auto create = [&storage]<std::size_t Index>(std::integral_constant<std::size_t, Index>)
+        {
+            for (auto [id, myComp, myComp2, variant] : storage.template Create<Archetype<MyComponent, MyComponent2, Variant<Index>>>(objectsPerArchetype))
+            {
+                myComp.x = Index;
+                myComp2.x = 0;
+            }
+        };
+
+        (create(std::integral_constant<std::size_t, Indices>()), ...);
+    }(std::make_index_sequence<archetypeCount>());
+
+    using UpdateQuery = Query::Read<MyComponent>::Write<MyComponent2>;
+
+    auto startConcat = std::chrono::steady_clock::now();
+    for (auto [myComp, myComp2] : storage.RunQuery<UpdateQuery>())
+        myComp2.x += myComp.x;
+    auto endConcat = std::chrono::steady_clock::now();
+
+    auto startForEach = std::chrono::steady_clock::now();
+    storage.ForEach<UpdateQuery>([](const MyComponent& myComp, MyComponent2& myComp2)
+    {
+        myComp2.x += myComp.x;
+    });
+    auto endForEach = std::chrono::steady_clock::now();
+
+    auto startChunked = std::chrono::steady_clock::now();
+    storage.ForEachChunk<UpdateQuery>([](auto& chunk)
+    {
+        auto [myComps, myComp2s] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            myComp2s[i].x += myComps[i].x;
+    });
+    auto endChunked = std::chrono::steady_clock::now();
+
+    std::size_t sum = 0;
+    storage.ForEach<Query::Read<MyComponent2>>([&sum](const MyComponent2& myComp2)
+    {
+        sum += myComp2.x;
+    });
+
+    std::cout
+        << "Query over " << archetypeCount << " archetypes of " << objectsPerArchetype << " objects, concat_view "
+        << std::chrono::duration<double, std::milli>(endConcat - startConcat).count()
+        << "ms ForEach " << std::chrono::duration<double, std::milli>(endForEach - startForEach).count()
+        << "ms ForEachChunk " << std::chrono::duration<double, std::milli>(endChunked - startChunked).count()
+        << "ms Checksum " << sum << std::endl;
+}
+
+void benchDynamicQuery()
+{
+    using Simple = Archetype<MyComponent, MyComponent2>;
+
+    const std::size_t objectCount = 1000000;
+
+    EcsStorage<Simple> storage;
+    for (auto [id, myComp, myComp2] : storage.Create<Simple>(objectCount))
+    {
+        myComp.x = 1;
+        myComp2.x = 0;
+    }
+
+    // Same layout as MyComponent2's first field, but only known at runtime, on objects of an archetype made at runtime
+    auto scriptValue = storage.RegisterComponentDynamic({ "ScriptValue", sizeof(std::size_t), alignof(std::size_t) });
+    std::vector<std::size_t> componentIds = { storage.GetComponentId<MyComponent>(), scriptValue };
+    auto archetype = storage.FindArchetypeIdDynamic(componentIds);
+
+    for (std::size_t i = 0; i < objectCount; ++i)
+    {
+        auto id = storage.CreateDynamic(archetype);
+        static_cast<MyComponent *>(storage.GetComponentDynamic(id, componentIds[0]))->x = 1;
+    }
+
+    auto startStatic = std::chrono::steady_clock::now();
+    storage.ForEachChunk<Query::Read<MyComponent>::Write<MyComponent2>>([](auto& chunk)
+    {
+        auto [myComps, myComp2s] = chunk.Spans;
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            myComp2s[i].x += myComps[i].x;
+    });
+    auto endStatic = std::chrono::steady_clock::now();
+
+    auto startFind = std::chrono::steady_clock::now();
+    auto query = storage.FindQueryDynamic(componentIds);
+    auto endFind = std::chrono::steady_clock::now();
+
+    auto startDynamic = std::chrono::steady_clock::now();
+    storage.RunQueryDynamic(query, [](const DynamicChunk& chunk)
+    {
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            chunk.Get<std::size_t>(1, i) += chunk.Get<MyComponent>(0, i).x;
+    });
+    auto endDynamic = std::chrono::steady_clock::now();
+
+    std::size_t sum = 0;
+    storage.RunQueryDynamic(storage.FindQueryDynamic(std::vector<std::size_t>{ scriptValue }), [&sum](const DynamicChunk& chunk)
+    {
+        for (std::size_t i = 0; i < chunk.Count; ++i)
+            sum += chunk.Get<std::size_t>(0, i);
+    });
+
+    std::cout
+        << "Dynamic query of " << objectCount << " objects, Static chunked " << std::chrono::duration<double, std::milli>(endStatic - startStatic).count()
+        << "ms Dynamic " << std::chrono::duration<double, std::milli>(endDynamic - startDynamic).count()
+        << "ms (cached lookup " << std::chrono::duration<double, std::micro>(endFind - startFind).count() << "us) Checksum " << sum << std::endl;
+}
+
 int main_()
 {
-    const auto poolSize = 256 * 1024 * 1024; // 256 MB
+    const auto poolSize = 256 * 1024 * 1024; // 256 MB reserved, committed on demand
     MemoryPool::Initialize(poolSize / BLOCK_SIZE);
 
     test();
+    benchPoolAllocation();
+    benchChangedQuery();
+    benchChunkedQuery();
+    benchSoaQuery();
+    benchFlagComponents();
+    benchSparseBitset();
+    benchBulkDelete();
+    benchCompaction();
+    benchParallelQuery();
+    benchMortonSort();
+    benchCommandBuffer();
+    benchMigration();
+    benchJoin();
+    benchHierarchy();
+    benchManyArchetypes();
+    benchDynamicQuery();
+
+    EpochReclaimer::Drain();
+    MemoryPool::Destroy();
+
+    // Simulated topology so the node-local path is measurable on single-node machines too
+    MemoryPoolOptions numaOptions;
+    numaOptions.SimulatedNodeCount = 2;
+    MemoryPool::Initialize(poolSize / BLOCK_SIZE, numaOptions);
+
+    benchNumaAllocation();
 
     MemoryPool::Destroy();
 }
\ No newline at end of file
@@ -1,20 +1,36 @@
 #pragma once
 
 #include "ParallelPooledStore.h"
+#include "ThreadPool.h"
+#include "CommandBuffer.h"
+#include "RelationIndex.h"
+#include "DynamicStore.h"
 
 #include <type_traits>
 #include <range/v3/view/concat.hpp>
 #include <tuple>
+#include <array>
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <bitset>
+#include <numeric>
+#include <unordered_map>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <limits>
 
 using ObjectId = std::size_t;
 
 template<
-	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs,
+	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch,
 	typename TRelationArchPath, typename TUsedComponentsArch, typename... TReadsWrites
 >
 class QueryImpl;
 
-template<typename TExcludedArch, typename TContainsOrExprs, typename TUsedComponentsArch, typename... TStores>
+template<typename TExcludedArch, typename TContainsOrExprs, typename TUsedComponentsArch, typename TChangedArch, typename... TStores>
 auto FilterStores(std::tuple<TStores...>& stores)
 {
 	auto filterFunc = []<typename TStore>(TStore& store)
@@ -22,6 +38,7 @@ auto FilterStores(std::tuple<TStores...>& stores)
 		if constexpr (
 			TExcludedArch::template AnyIn<TStore::ArchType> ||
 			!(TUsedComponentsArch::template IsSubsetOf<TStore::ArchType>) ||
+			!(TChangedArch::template IsSubsetOf<TStore::ArchType>) ||
 			(TContainsOrExprs::template MeetsAnyCriterion<TStore::ArchType> && !std::same_as<TContainsOrExprs, EmptyArchetype>)
 		)
 			return std::make_tuple();
@@ -37,24 +54,92 @@ auto FilterStores(std::tuple<TStores...>& stores)
 	);
 }
 
+// Calls func(index, value) with a column of the store for every object of a view of it, skipping the ones its
+// change filter rejects
+template<typename TColumn, typename TStore, typename TView, typename TFunc>
+void ScanColumn(TStore& store, const TView& view, TFunc&& func)
+{
+	auto column = store.template GetView<WriteMode::Copy, const TColumn>();
+	auto& filter = view.GetChangeFilter();
+
+	for (auto iter = column.begin(), end = column.end(); iter != end; ++iter)
+	{
+		auto index = iter.GetIndex();
+		if (index < view.GetBeginIndex())
+			continue;
+
+		if (index >= view.GetEndIndex())
+			break;
+
+		if (!filter.FindChanged || filter.FindChanged(index, index + 1) == index)
+			func(index, std::get<0>(*iter));
+	}
+}
+
+// The links of a level whose sources belong to the store, they are next to each other
+template<typename TStore>
+std::span<const RelationLevels::Link> FindStoreLinks(TStore& store, std::span<const RelationLevels::Link> links)
+{
+	auto [first, last] = std::ranges::equal_range(links, store.GetIdPrefix(), {}, [](const RelationLevels::Link& link) { return link.first & ID_PREFIX_MASK; });
+	return std::span<const RelationLevels::Link>(first, last);
+}
+
+// One concat_view per level of a LevelTraverse query
+template<typename TLevel>
+auto ConcatLevels(std::vector<TLevel> levels)
+{
+	auto concat = [](auto&... view)
+	{
+		return ranges::concat_view(view...);
+	};
+
+	std::vector<decltype(std::apply(concat, levels.front()))> concatLevels;
+	for (auto& level : levels)
+		concatLevels.push_back(std::apply(concat, level));
+
+	return concatLevels;
+}
+
+// Runs the levels one after another, each level's views as tasks on the pool
+template<typename TLevel, typename TFunc>
+void RunLevelsParallel(std::vector<TLevel>& levels, ThreadPool& pool, TFunc& func)
+{
+	for (auto& level : levels)
+	{
+		std::apply([&](auto&... view)
+		{
+			// Tasks of view i are numbered from firstTasks[i]
+			std::array<std::size_t, sizeof...(view) + 1> firstTasks = {};
+			std::size_t viewIndex = 0;
+			((firstTasks[viewIndex + 1] = firstTasks[viewIndex] + view.GetTaskCount(), ++viewIndex), ...);
+
+			pool.ParallelFor(firstTasks.back(), [&](std::size_t task)
+			{
+				std::size_t viewIndex = 0;
+				((task >= firstTasks[viewIndex] && task < firstTasks[viewIndex + 1] ? view.RunTask(task - firstTasks[viewIndex], func) : void(), ++viewIndex), ...);
+			});
+		}, level);
+	}
+}
+
 // Simple sequential
 template<
-	typename TExcludedArch, typename TContainsOrExprs,
+	typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch,
 	typename TUsedComponentsArch, typename... TReadsWrites
 >
-class QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, EmptyArchetype, TUsedComponentsArch, TReadsWrites...>
+class QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, TChangedArch, EmptyArchetype, TUsedComponentsArch, TReadsWrites...>
 {
 public:
-	template<typename... TStores>
-	static auto GetView(std::tuple<TStores...>& stores)
+	template<WriteMode Mode = WriteMode::Copy, typename... TStores>
+	static auto GetView(std::tuple<TStores...>& stores, ChangeVersion since = 0)
 	{
 		auto getView =
-			[]<typename TStore>(TStore& store)
+			[since]<typename TStore>(TStore& store)
 		{
-			return store.template GetView<TReadsWrites...>();
+			return GetStoreView<Mode>(store, since);
 		};
 		
-		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TStores...>(stores);
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
 
 		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
 
@@ -64,67 +149,447 @@ public:
 		}, filtered);
 	}
 
+	// Stores the query runs on, joins use it to find the stores of their source side
+	template<typename... TStores>
+	static auto GetStores(std::tuple<TStores...>& stores)
+	{
+		return FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+	}
+
+	template<WriteMode Mode, typename TStore>
+	static auto GetStoreView(TStore& store, ChangeVersion since)
+	{
+		if constexpr (std::same_as<TChangedArch, EmptyArchetype>)
+			return store.template GetView<Mode, TReadsWrites...>();
+		else
+			return store.template GetChangedView<Mode, TChangedArch, TReadsWrites...>(since);
+	}
+
+	template<WriteMode Mode = WriteMode::Copy, typename... TStores>
+	static auto GetChunkedView(std::tuple<TStores...>& stores, ChangeVersion since = 0)
+	{
+		auto getChunks =
+			[since]<typename TStore>(TStore& store)
+		{
+			return GetStoreView<Mode>(store, since).Chunks();
+		};
+
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
+
+		return std::apply([&getChunks]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
+		{
+			return ranges::concat_view(getChunks(filteredStores)...);
+		}, filtered);
+	}
+
 	template<typename... TStores>
-	static auto GetView(std::tuple<TStores...>& stores, std::size_t id)
+	static auto GetViewAt(std::tuple<TStores...>& stores, std::size_t id)
 	{
 		auto getViewAt =
-			[&id]<typename TStore>(TStore& store)
+			[id]<typename TStore>(TStore& store)
 			{
 				return store.template GetViewAt<TReadsWrites...>(id);
 			};
 
-		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TStores...>(stores);
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
 
 		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must accept at least one component!");
 
 		return std::apply([&getViewAt]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
 		{
-			return ranges::concat_view(getViewAt(id)...);
+			return ranges::concat_view(getViewAt(filteredStores)...);
+		}, filtered);
+	}
+
+	// Splits every matching store into block aligned tasks and runs them on the pool. func gets the components of
+	// each object, or a StoreChunk at a time if Chunked
+	template<bool Chunked, WriteMode Mode = WriteMode::Copy, typename TFunc, typename... TStores>
+	static void ForEachParallel(std::tuple<TStores...>& stores, ThreadPool& pool, TFunc& func, ChangeVersion since = 0)
+	{
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
+
+		std::apply([&]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
+		{
+			// Views over whole stores keep compaction away until the last task is done
+			auto views = std::make_tuple(GetStoreView<Mode>(filteredStores, since)...);
+
+			// Tasks of store i are numbered from firstTasks[i]
+			std::array<std::size_t, sizeof...(TFilteredStores) + 1> firstTasks = {};
+			std::apply([&firstTasks](auto&... view)
+			{
+				std::size_t store = 0;
+				((firstTasks[store + 1] = firstTasks[store] + view.GetTaskCount(), ++store), ...);
+			}, views);
+
+			pool.ParallelFor(firstTasks.back(), [&](std::size_t task)
+			{
+				std::apply([&](auto&... view)
+				{
+					std::size_t store = 0;
+					((task >= firstTasks[store] && task < firstTasks[store + 1] ? RunTask<Chunked>(view, task - firstTasks[store], func) : void(), ++store), ...);
+				}, views);
+			});
+		}, filtered);
+	}
+
+	// Runs func over the matching stores one after another, the loop over each store's view is unrolled per store
+	// type so func inlines into it. func gets the components of each object, or a StoreChunk at a time if Chunked
+	template<bool Chunked, WriteMode Mode = WriteMode::Copy, typename TFunc, typename... TStores>
+	static void ForEach(std::tuple<TStores...>& stores, TFunc& func, ChangeVersion since = 0)
+	{
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
+
+		std::apply([&]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
+		{
+			(RunView<Chunked>(GetStoreView<Mode>(filteredStores, since), func), ...);
+		}, filtered);
+	}
+
+	template<typename TPredicate, typename... TStores>
+	static std::size_t DeleteWhere(std::tuple<TStores...>& stores, TPredicate& predicate, ChangeVersion since = 0)
+	{
+		auto deleteWhere =
+			[&predicate, since]<typename TStore>(TStore& store)
+			{
+				auto view = GetStoreView<WriteMode::Copy>(store, since);
+				return store.DeleteWhere(view, predicate);
+			};
+
+		auto filtered = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
+
+		return std::apply([&deleteWhere]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
+		{
+			return (deleteWhere(filteredStores) + ...);
 		}, filtered);
 	}
+private:
+	template<bool Chunked, typename TView, typename TFunc>
+	static void RunTask(const TView& view, std::size_t task, TFunc& func)
+	{
+		RunView<Chunked>(view.GetTaskView(task), func);
+	}
+
+	template<bool Chunked, typename TView, typename TFunc>
+	static void RunView(TView&& view, TFunc& func)
+	{
+		if constexpr (Chunked)
+		{
+			for (auto chunk : view.Chunks())
+				func(chunk);
+		}
+		else
+		{
+			// The end is made once, not on every step like concat_view does
+			for (auto iter = view.begin(), end = view.end(); iter != end; ++iter)
+				std::apply(func, *iter);
+		}
+	}
+};
+
+// One hop of a relational query, from the objects of the source query to the objects their relation points at
+template<RelationComponent TRelation, typename TSourceQuery>
+struct JoinStep
+{
+};
+
+template<typename TRelationArchPath, typename TRelation>
+struct IsJoinOn
+{
+	static inline constexpr bool Value = false;
 };
 
-// Relational
+template<typename TRelation, typename TSourceQuery>
+struct IsJoinOn<Archetype<JoinStep<TRelation, TSourceQuery>>, TRelation>
+{
+	static inline constexpr bool Value = true;
+};
+
+// Relational, a single Join. The query before Join<TRelation> picks the sources like a simple query would, the reads
+// after it come from the objects the relation points at
 template<
-	typename TExcludedArch, typename TContainsOrExprs, typename TRelationArchPath,
+	typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch, typename TRelation, typename TSourceQuery,
 	typename TUsedComponentsArch, typename... TReadsWrites
 >
-class QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, TRelationArchPath, TUsedComponentsArch, TReadsWrites...>
+class QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, TChangedArch, Archetype<JoinStep<TRelation, TSourceQuery>>, TUsedComponentsArch, TReadsWrites...>
 {
+	static_assert((std::is_const_v<TReadsWrites> && ...), "The target side of a join is read only!");
+	static_assert(std::same_as<TChangedArch, EmptyArchetype>, "Changed filters go before the Join!");
 public:
-	// TODO: implement
+	// Yields the source's components followed by the target's, once per source whose target is alive and matches.
+	// Targets are read as they were before the query, also where sources and targets share a store
+	template<WriteMode Mode = WriteMode::Copy, typename... TStores>
+	static auto GetView(std::tuple<TStores...>& stores, ChangeVersion since = 0)
+	{
+		auto sourceStores = TSourceQuery::GetStores(stores);
+		auto relationStores = FilterStores<EmptyArchetype, EmptyArchetype, Archetype<TRelation>, EmptyArchetype>(sourceStores);
+		auto targetStores = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(relationStores)> > 0, "The source side of a join must match an archetype with the relation!");
+		static_assert(std::tuple_size_v<decltype(targetStores)> > 0, "The target side of a join must match at least one archetype!");
+
+		// A view per pair of source and target store
+		auto joinsOf = [&](auto& sourceStore)
+		{
+			return std::apply([&](auto&... targetStore)
+			{
+				return std::make_tuple(GetJoinView<Mode>(sourceStore, targetStore, since)...);
+			}, targetStores);
+		};
+
+		auto joins = std::apply([&](auto&... sourceStore)
+		{
+			return std::tuple_cat(joinsOf(sourceStore)...);
+		}, relationStores);
+
+		return std::apply([](auto&... join)
+		{
+			return ranges::concat_view(join...);
+		}, joins);
+	}
+private:
+	// Hash join with the target store's id map as the table. The source store's relation column is scanned in
+	// order, so the rows come out sorted by source and only the targets are looked up
+	template<WriteMode Mode, typename TSourceStore, typename TTargetStore>
+	static auto GetJoinView(TSourceStore& sourceStore, TTargetStore& targetStore, ChangeVersion since)
+	{
+		auto source = TSourceQuery::template GetStoreView<Mode>(sourceStore, since);
+		auto target = targetStore.template GetView<WriteMode::Copy, TReadsWrites...>();
+
+		std::vector<std::pair<std::size_t, std::size_t>> rows;
+
+		ScanColumn<TRelation>(sourceStore, source, [&](std::size_t sourceIndex, const TRelation& relation)
+		{
+			if ((relation.Target & ID_PREFIX_MASK) != targetStore.GetIdPrefix())
+				return;
+
+			auto targetIndex = targetStore.FindIndex(relation.Target);
+			if (targetIndex < target.GetEndIndex())
+				rows.emplace_back(sourceIndex, targetIndex);
+		});
+
+		return IndexedView(std::move(rows), std::move(source), std::move(target));
+	}
 };
 
-// BFS Relation Tree
+// Relational, chained joins and JoinRecursive
 template<
-	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs,
+	typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch, typename TRelationArchPath,
 	typename TUsedComponentsArch, typename... TReadsWrites
 >
-class QueryImpl<TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, EmptyArchetype, TUsedComponentsArch, TReadsWrites...>
+class QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, TChangedArch, TRelationArchPath, TUsedComponentsArch, TReadsWrites...>
 {
 public:
 	// TODO: implement
 };
 
+// BFS Relation Tree. A view per level of the relation's trees, roots first, so a system can be done with a level
+// before the objects pointing at it. Roots are the objects without the relation or with Target 0
+template<
+	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch,
+	typename TUsedComponentsArch, typename... TReadsWrites
+>
+class QueryImpl<TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TChangedArch, EmptyArchetype, TUsedComponentsArch, TReadsWrites...>
+{
+	using SimpleQuery = QueryImpl<std::monostate, TExcludedArch, TContainsOrExprs, TChangedArch, EmptyArchetype, TUsedComponentsArch, TReadsWrites...>;
+public:
+	using TraverseRelation = TLevelTraverseRelation;
+
+	template<WriteMode Mode = WriteMode::Copy, typename... TStores>
+	static auto GetView(std::tuple<TStores...>& stores, RelationLevels& levels, ChangeVersion since = 0)
+	{
+		return ConcatLevels(GetLevels<Mode>(stores, levels, since));
+	}
+
+	// Levels run one after another, the objects of a level in block aligned tasks on the pool
+	template<typename TFunc, typename... TStores>
+	static void ForEachLevelParallel(std::tuple<TStores...>& stores, RelationLevels& levels, ThreadPool& pool, TFunc& func, ChangeVersion since = 0)
+	{
+		auto levelViews = GetLevels<WriteMode::Copy>(stores, levels, since);
+		RunLevelsParallel(levelViews, pool, func);
+	}
+private:
+	template<WriteMode Mode, typename... TStores>
+	static auto GetLevels(std::tuple<TStores...>& stores, RelationLevels& levels, ChangeVersion since)
+	{
+		auto filtered = SimpleQuery::GetStores(stores);
+
+		static_assert(std::tuple_size_v<decltype(filtered)> > 0, "Query must match at least one component!");
+
+		return std::apply([&]<typename... TFilteredStores>(TFilteredStores&... filteredStores)
+		{
+			std::vector<std::tuple<IndexedView<decltype(SimpleQuery::template GetStoreView<Mode>(filteredStores, since))>...>> levelViews;
+			levelViews.emplace_back(GetRoots<Mode>(filteredStores, since)...);
+
+			for (std::size_t level = 0; level < levels.GetLevelCount(); ++level)
+			{
+				auto links = levels.GetLevel(level);
+				levelViews.emplace_back(GetLevel<Mode>(filteredStores, links, since)...);
+			}
+
+			return levelViews;
+		}, filtered);
+	}
+
+	template<WriteMode Mode, typename TStore>
+	static auto GetRoots(TStore& store, ChangeVersion since)
+	{
+		auto view = SimpleQuery::template GetStoreView<Mode>(store, since);
+		std::vector<std::pair<std::size_t, std::size_t>> rows;
+
+		if constexpr (TStore::ArchType::template Contains<TLevelTraverseRelation>)
+		{
+			ScanColumn<TLevelTraverseRelation>(store, view, [&rows](std::size_t index, const TLevelTraverseRelation& relation)
+			{
+				if (relation.Target == 0)
+					rows.emplace_back(index, 0);
+			});
+		}
+		else
+			ScanColumn<std::size_t>(store, view, [&rows](std::size_t index, std::size_t) { rows.emplace_back(index, 0); });
+
+		return IndexedView(std::move(rows), std::move(view));
+	}
+
+	template<WriteMode Mode, typename TStore>
+	static auto GetLevel(TStore& store, std::span<const RelationLevels::Link> links, ChangeVersion since)
+	{
+		auto view = SimpleQuery::template GetStoreView<Mode>(store, since);
+		std::vector<std::pair<std::size_t, std::size_t>> rows;
+
+		auto& filter = view.GetChangeFilter();
+		for (auto [id, target] : FindStoreLinks(store, links))
+		{
+			auto index = store.FindIndex(id);
+			if (index >= view.GetBeginIndex() && index < view.GetEndIndex() && (!filter.FindChanged || filter.FindChanged(index, index + 1) == index))
+				rows.emplace_back(index, 0);
+		}
+
+		// Ids come in creation order, which is also index order until compaction or sorting moves objects
+		if (!std::ranges::is_sorted(rows))
+			std::ranges::sort(rows);
+
+		return IndexedView(std::move(rows), std::move(view));
+	}
+};
+
+// BFS Relation Tree over a Join on the same relation, each object comes with the components of the one it points
+// at. Roots have nothing to join with, so the levels start at the objects pointing at a root
+template<
+	typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch, typename TRelation, typename TSourceQuery,
+	typename TUsedComponentsArch, typename... TReadsWrites
+>
+class QueryImpl<TRelation, TExcludedArch, TContainsOrExprs, TChangedArch, Archetype<JoinStep<TRelation, TSourceQuery>>, TUsedComponentsArch, TReadsWrites...>
+{
+	static_assert((std::is_const_v<TReadsWrites> && ...), "The target side of a join is read only!");
+	static_assert(std::same_as<TChangedArch, EmptyArchetype>, "Changed filters go before the Join!");
+public:
+	using TraverseRelation = TRelation;
+
+	template<WriteMode Mode = WriteMode::Copy, typename... TStores>
+	static auto GetView(std::tuple<TStores...>& stores, RelationLevels& levels, ChangeVersion since = 0)
+	{
+		return ConcatLevels(GetLevels<Mode>(stores, levels, since));
+	}
+
+	// Levels run one after another, the objects of a level in block aligned tasks on the pool. Writes of a level
+	// are published before the next one reads them through the join
+	template<typename TFunc, typename... TStores>
+	static void ForEachLevelParallel(std::tuple<TStores...>& stores, RelationLevels& levels, ThreadPool& pool, TFunc& func, ChangeVersion since = 0)
+	{
+		auto levelViews = GetLevels<WriteMode::Copy>(stores, levels, since);
+		RunLevelsParallel(levelViews, pool, func);
+	}
+private:
+	template<WriteMode Mode, typename... TStores>
+	static auto GetLevels(std::tuple<TStores...>& stores, RelationLevels& levels, ChangeVersion since)
+	{
+		auto sourceStores = TSourceQuery::GetStores(stores);
+		auto relationStores = FilterStores<EmptyArchetype, EmptyArchetype, Archetype<TRelation>, EmptyArchetype>(sourceStores);
+		auto targetStores = FilterStores<TExcludedArch, TContainsOrExprs, TUsedComponentsArch, TChangedArch, TStores...>(stores);
+
+		static_assert(std::tuple_size_v<decltype(relationStores)> > 0, "The source side of a join must match an archetype with the relation!");
+		static_assert(std::tuple_size_v<decltype(targetStores)> > 0, "The target side of a join must match at least one archetype!");
+
+		// A view per pair of source and target store on each level
+		auto getJoins = [&](std::span<const RelationLevels::Link> links)
+		{
+			auto joinsOf = [&](auto& sourceStore)
+			{
+				return std::apply([&](auto&... targetStore)
+				{
+					return std::make_tuple(GetJoin<Mode>(sourceStore, targetStore, links, since)...);
+				}, targetStores);
+			};
+
+			return std::apply([&](auto&... sourceStore)
+			{
+				return std::tuple_cat(joinsOf(sourceStore)...);
+			}, relationStores);
+		};
+
+		std::vector<decltype(getJoins({}))> levelViews;
+		for (std::size_t level = 0; level < levels.GetLevelCount(); ++level)
+			levelViews.push_back(getJoins(levels.GetLevel(level)));
+
+		return levelViews;
+	}
+
+	template<WriteMode Mode, typename TSourceStore, typename TTargetStore>
+	static auto GetJoin(TSourceStore& sourceStore, TTargetStore& targetStore, std::span<const RelationLevels::Link> links, ChangeVersion since)
+	{
+		auto source = TSourceQuery::template GetStoreView<Mode>(sourceStore, since);
+		auto target = targetStore.template GetView<WriteMode::Copy, TReadsWrites...>();
+		std::vector<std::pair<std::size_t, std::size_t>> rows;
+
+		auto& filter = source.GetChangeFilter();
+		for (auto [id, targetId] : FindStoreLinks(sourceStore, links))
+		{
+			if ((targetId & ID_PREFIX_MASK) != targetStore.GetIdPrefix())
+				continue;
+
+			auto sourceIndex = sourceStore.FindIndex(id);
+			if (sourceIndex < source.GetBeginIndex() || sourceIndex >= source.GetEndIndex() || (filter.FindChanged && filter.FindChanged(sourceIndex, sourceIndex + 1) != sourceIndex))
+				continue;
+
+			auto targetIndex = targetStore.FindIndex(targetId);
+			if (targetIndex < target.GetEndIndex())
+				rows.emplace_back(sourceIndex, targetIndex);
+		}
+
+		if (!std::ranges::is_sorted(rows))
+			std::ranges::sort(rows);
+
+		return IndexedView(std::move(rows), std::move(source), std::move(target));
+	}
+};
+
 template<
-	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs, 
+	typename TLevelTraverseRelation, typename TExcludedArch, typename TContainsOrExprs, typename TChangedArch,
 	typename TRelationArchPath, typename TUsedComponentsArch, typename... TReadsWrites
 >
 class QueryBase : 
-	public QueryImpl<TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TRelationArchPath, TUsedComponentsArch, TReadsWrites...>
+	public QueryImpl<TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TChangedArch, TRelationArchPath, TUsedComponentsArch, TReadsWrites...>
 {
 public:
 	template<typename... TComponents> requires !(TUsedComponentsArch::template AnyIn<Archetype<TComponents...>>)
 	using Read = 
 		QueryBase<
-			TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TRelationArchPath,
+			TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TChangedArch, TRelationArchPath,
 			typename TUsedComponentsArch::template Append<TComponents...>, TReadsWrites..., const TComponents...
 		>;
 
 	template<typename... TComponents> requires !TUsedComponentsArch::template AnyIn<Archetype<TComponents...>>
 	using Write =
 		QueryBase<
-			TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TRelationArchPath,
+			TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, TChangedArch, TRelationArchPath,
 			typename TUsedComponentsArch::template Append<TComponents...>, TReadsWrites..., TComponents...
 		>;
 
@@ -132,120 +597,1151 @@ public:
 	using ContainingAll =
 		QueryBase<
 			TLevelTraverseRelation, TExcludedArch, typename TContainsOrExprs::template Append<Archetype<TComponents...>>,
-			TRelationArchPath, TUsedComponentsArch, TReadsWrites...
+			TChangedArch, TRelationArchPath, TUsedComponentsArch, TReadsWrites...
 		>;
 
 	template<typename... TComponents>
 	using ContainingAny =
 		QueryBase<
 		TLevelTraverseRelation, TExcludedArch, typename TContainsOrExprs::template Append<Archetype<TComponents>...>,
-		TRelationArchPath, TUsedComponentsArch, TReadsWrites...
+		TChangedArch, TRelationArchPath, TUsedComponentsArch, TReadsWrites...
 		>;
 
 	template<typename... TComponents>
 	using Exclude =
 		QueryBase<
 			TLevelTraverseRelation, typename TExcludedArch::template Append<TComponents...>, TContainsOrExprs,
+			TChangedArch, TRelationArchPath, TUsedComponentsArch, TReadsWrites...
+		>;
+
+	// Skips objects whose blocks of these components weren't written since the version passed to RunQuerySince,
+	// an object passes if any of them changed
+	template<typename... TComponents>
+	using Changed =
+		QueryBase<
+			TLevelTraverseRelation, TExcludedArch, TContainsOrExprs, typename TChangedArch::template Append<TComponents...>,
 			TRelationArchPath, TUsedComponentsArch, TReadsWrites...
 		>;
 
-	template<typename TTreeRelationType> requires std::same_as<TRelationArchPath, EmptyArchetype>
+	// Level by level down the relation's trees, roots first. After a Join on the same relation, each object comes
+	// with the components of the one it points at
+	template<RelationComponent TTreeRelationType>
+		requires std::same_as<TLevelTraverseRelation, std::monostate> &&
+			(std::same_as<TRelationArchPath, EmptyArchetype> || IsJoinOn<TRelationArchPath, TTreeRelationType>::Value)
 	using LevelTraverse = 
 		QueryBase<
-			TTreeRelationType, TExcludedArch, TContainsOrExprs,
+			TTreeRelationType, TExcludedArch, TContainsOrExprs, TChangedArch,
 			TRelationArchPath, TUsedComponentsArch, TReadsWrites...
 		>;
 
-	template<typename ...TRelationTypes> requires std::same_as<TLevelTraverseRelation, std::monostate>
+	// Follows the relation from the objects matched so far, the query so far becomes the source side. Reads and
+	// filters after it apply to the objects the relation points at
+	template<RelationComponent TRelation> requires std::same_as<TLevelTraverseRelation, std::monostate>
 	using Join =
 		QueryBase<
-			std::monostate, TExcludedArch, TContainsOrExprs,
-			typename TRelationArchPath::template Append<Archetype<TRelationTypes...>>, TUsedComponentsArch, TReadsWrites...
+			std::monostate, EmptyArchetype, EmptyArchetype, EmptyArchetype,
+			typename TRelationArchPath::template AppendNoUnion<JoinStep<TRelation, QueryBase>>, EmptyArchetype
 		>;
 
 	template<typename ...TRelationTypes> requires std::same_as<TLevelTraverseRelation, std::monostate>
 	using JoinRecursive = 
 		QueryBase<
-			std::monostate, TExcludedArch, TContainsOrExprs,
+			std::monostate, TExcludedArch, TContainsOrExprs, TChangedArch,
 			typename TRelationArchPath::template Append<const Archetype<TRelationTypes...>>, TUsedComponentsArch, TReadsWrites...
 		>;
 };
 
-using Query = QueryBase<std::monostate, EmptyArchetype, EmptyArchetype, EmptyArchetype, EmptyArchetype>;
+using Query = QueryBase<std::monostate, EmptyArchetype, EmptyArchetype, EmptyArchetype, EmptyArchetype, EmptyArchetype>;
 
 template<typename... TArchetypes>
 class EcsStorage
 {
+	static_assert(sizeof...(TArchetypes) <= (1ull << (63 - ARCHETYPE_ID_SHIFT)), "Too many archetypes for the id layout!");
 public:
-	EcsStorage()
+	EcsStorage() : m_changeClock(1)
 	{
 		// Set prefixes on all
 		std::apply(
-			[]<typename... TStores>(TStores&... store)
+			[this]<typename... TStores>(TStores&... store)
 			{
-				std::size_t i = 1ull << 63;
+				std::size_t i = 0;
 				((store.SetIdPrefix(i++)), ...);
+				((store.SetChangeClock(&m_changeClock)), ...);
 			}, m_stores
 		);
+
+		[this]<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+		{
+			(m_registry.Register(MakeComponentInfo<TComponents>()), ...);
+		}(std::type_identity<Components>());
 	}
 
+	// LevelTraverse queries give a view per level instead
 	template<typename TQuery>
 	auto RunQuery()
 	{
-		return TQuery::GetView(m_stores);
+		return RunQuerySince<TQuery>(0);
+	}
+
+	// Changed<T> filters of the query only let through objects whose blocks were written at or after since
+	template<typename TQuery>
+	auto RunQuerySince(ChangeVersion since)
+	{
+		if constexpr (requires { typename TQuery::TraverseRelation; })
+		{
+			return TQuery::GetView(m_stores, UpdateRelationLevels<typename TQuery::TraverseRelation>(), since);
+		}
+		else
+			return TQuery::GetView(m_stores, since);
+	}
+
+	// Writes lock each block and go straight into it instead of through an RCU copy. Only valid while no other
+	// system reads the queried archetypes, e.g. when the scheduler knows this system has them to itself
+	template<typename TQuery>
+	auto RunQueryExclusive(ChangeVersion since = 0)
+	{
+		return TQuery::template GetView<WriteMode::InPlace>(m_stores, since);
+	}
+
+	// Yields a StoreChunk per block instead of one object at a time, for loops that should vectorize
+	template<typename TQuery>
+	auto RunQueryChunked(ChangeVersion since = 0)
+	{
+		return TQuery::GetChunkedView(m_stores, since);
+	}
+
+	template<typename TQuery>
+	auto RunQueryChunkedExclusive(ChangeVersion since = 0)
+	{
+		return TQuery::template GetChunkedView<WriteMode::InPlace>(m_stores, since);
+	}
+
+	// Calls func with the components of every object matching the query, like the body of a RunQuery loop but
+	// without the per object dispatch between archetypes, so it pays off for queries matching many of them
+	template<typename TQuery, typename TFunc>
+	void ForEach(TFunc func, ChangeVersion since = 0)
+	{
+		TQuery::template ForEach<false>(m_stores, func, since);
+	}
+
+	template<typename TQuery, typename TFunc>
+	void ForEachExclusive(TFunc func, ChangeVersion since = 0)
+	{
+		TQuery::template ForEach<false, WriteMode::InPlace>(m_stores, func, since);
+	}
+
+	// Chunked version of ForEach, func gets a StoreChunk at a time
+	template<typename TQuery, typename TFunc>
+	void ForEachChunk(TFunc func, ChangeVersion since = 0)
+	{
+		TQuery::template ForEach<true>(m_stores, func, since);
+	}
+
+	// Calls func with the components of every object matching the query, like the body of a RunQuery loop, from
+	// all threads of the pool. Objects are handed out in block aligned tasks, so writes never contend for a block.
+	// LevelTraverse queries finish a level before starting the next. Changed filters skip blocks not written since
+	// the given version, as with RunQuerySince
+	template<typename TQuery, typename TFunc>
+	void RunQueryParallel(TFunc func, ThreadPool& pool = ThreadPool::GetShared(), ChangeVersion since = 0)
+	{
+		if constexpr (requires { typename TQuery::TraverseRelation; })
+		{
+			TQuery::ForEachLevelParallel(m_stores, UpdateRelationLevels<typename TQuery::TraverseRelation>(), pool, func, since);
+		}
+		else
+			TQuery::template ForEachParallel<false>(m_stores, pool, func, since);
+	}
+
+	// Chunked version of RunQueryParallel, func gets a StoreChunk at a time
+	template<typename TQuery, typename TFunc>
+	void ParallelForEachChunk(TFunc func, ThreadPool& pool = ThreadPool::GetShared(), ChangeVersion since = 0)
+	{
+		TQuery::template ForEachParallel<true>(m_stores, pool, func, since);
 	}
 
 	template<typename TQuery>
 	auto RunQuery(std::size_t rootId)
 	{
-		return TQuery::GetView(m_stores, rootId);
+		return TQuery::GetViewAt(m_stores, rootId);
+	}
+
+	// Objects pointing at the target through the relation, e.g. the children of an object with Parent
+	template<RelationComponent TRelation>
+	auto GetRelationSources(std::size_t targetId)
+	{
+		return UpdateRelationIndex<TRelation>().GetSources(targetId) | std::views::values
+			| std::views::filter([this](std::size_t sourceId) { return IsAlive(sourceId); });
+	}
+
+	// Version that writes are currently stamped with. A system remembers it when it runs and passes it to
+	// RunQuerySince next time to only see what changed in between
+	ChangeVersion GetChangeVersion()
+	{
+		return m_changeClock.load();
+	}
+
+	// Called at sync points (e.g. once per frame) so writes after it can be told apart from writes before it
+	ChangeVersion AdvanceChangeVersion()
+	{
+		return ++m_changeClock;
 	}
 
+	// The view has the components in the archetype's order, whichever equivalent archetype the store was listed as
 	template<typename TArchetype>
 	auto Create(std::size_t count)
 	{
-		return std::get<typename TArchetype::StoreType>(m_stores).Emplace(count);
+		return [&]<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+		{
+			return std::get<typename TArchetype::StoreType>(m_stores).template Emplace<TComponents...>(count);
+		}(std::type_identity<TArchetype>());
 	}
 
+	// False if the id is stale, e.g. kept past its object's deletion
 	template<typename TArchetype>
-	void Delete(std::size_t objId)
+	bool Delete(std::size_t objId)
 	{
 		return std::get<typename TArchetype::StoreType>(m_stores).Delete(objId);
 	}
 
-	std::size_t FindComponentIdDynamic(std::string_view componentName)
+	// Copies of components of one object without a query, empty if the id is stale. RunQuery(id) gives a view to
+	// read or write them in place
+	template<typename TArchetype, typename... TComponents>
+	auto TryGet(std::size_t objId)
 	{
-		// TODO: Implement
-		return 0;
+		return std::get<typename TArchetype::StoreType>(m_stores).template TryGet<const TComponents...>(objId);
 	}
 
-	template<std::ranges::input_range TRange>
-	std::size_t FindArchetypeIdDynamic(TRange componentIds) requires std::same_as<std::ranges::range_value_t<TRange>, std::size_t>
+	// Moves the object to the archetype with the component added, or sets it if the object already has it. Returns
+	// the object's new id, the archetype is part of it. 0 if the id is stale or the storage has no such archetype
+	template<typename TComponent>
+	std::size_t AddComponent(std::size_t objId, const TComponent& value = {})
 	{
-		// TODO: Implement
-		return 0;
+		std::size_t newId = 0;
+		MoveObjects(std::span(&objId, 1), std::span(&newId, 1), GetComponentMask<Archetype<TComponent>>(), ComponentMask(), value);
+		return newId;
 	}
 
-	std::size_t CreateDynamic(std::size_t archetypeId)
+	template<typename TComponent>
+	std::size_t RemoveComponent(std::size_t objId)
 	{
-		// TODO: Implement
-		return 0;
+		std::size_t newId = 0;
+		MoveObjects(std::span(&objId, 1), std::span(&newId, 1), ComponentMask(), GetComponentMask<Archetype<TComponent>>());
+		return newId;
 	}
 
-	void DeleteDynamic(std::size_t objId)
+	// Batched versions for many objects changing together, e.g. everything hit this frame starts burning. Objects
+	// are grouped by archetype and each group moves a column at a time. Returns the new ids in the order of objIds
+	template<typename TComponent>
+	std::vector<std::size_t> AddComponents(std::span<const std::size_t> objIds, const TComponent& value = {})
 	{
-		// TODO: Implement
+		std::vector<std::size_t> newIds(objIds.size());
+		MoveObjects(objIds, newIds, GetComponentMask<Archetype<TComponent>>(), ComponentMask(), value);
+		return newIds;
 	}
 
-	void AddComponentDynamic(std::size_t objId, std::size_t componentId)
+	template<typename TComponent>
+	std::vector<std::size_t> RemoveComponents(std::span<const std::size_t> objIds)
 	{
-		// TODO: Implement
+		std::vector<std::size_t> newIds(objIds.size());
+		MoveObjects(objIds, newIds, ComponentMask(), GetComponentMask<Archetype<TComponent>>());
+		return newIds;
 	}
 
-	void RemoveComponentDynamic(std::size_t objId, std::size_t componentId)
+	// Batched deletes, tombstones are set a word of objects at a time instead of one atomic op per object
+	template<typename TArchetype, std::ranges::input_range TRange>
+	void DeleteMany(TRange&& objIds)
 	{
-		// TODO: Implement
+		std::get<typename TArchetype::StoreType>(m_stores).DeleteMany(std::forward<TRange>(objIds));
 	}
-private:
-	std::tuple<typename TArchetypes::StoreType...> m_stores; // TODO: implement component order agnostic archetypes
+
+	// Deletes everything in a view of the archetype's store, e.g. the result of Create
+	template<typename TArchetype, typename TView>
+	void DeleteRange(TView& view)
+	{
+		std::get<typename TArchetype::StoreType>(m_stores).DeleteRange(view);
+	}
+
+	// Deletes the objects matching the query that the predicate accepts, it gets the query's components the way a
+	// RunQuery loop does. Returns how many were deleted
+	template<typename TQuery, typename TPredicate>
+	std::size_t DeleteWhere(TPredicate predicate, ChangeVersion since = 0)
+	{
+		return TQuery::DeleteWhere(m_stores, predicate, since);
+	}
+
+	using CommandBufferType = CommandBuffer<TArchetypes...>;
+
+	// Applies the commands recorded in the buffers and clears them, at a sync point with no system running. Deletes
+	// go first, sorted so each store gets one batched DeleteMany, then creates with one Emplace per archetype, then
+	// component adds and removes. Those are folded per object in the order they were recorded, buffer by buffer,
+	// into a single move to the archetype with the resulting components, where the object gets a new id. Commands
+	// on stale ids or that would need an archetype the storage doesn't have are dropped
+	void Playback(std::span<CommandBuffer<TArchetypes...>> buffers)
+	{
+		std::vector<std::size_t> deletes;
+		for (auto& buffer : buffers)
+			deletes.insert(deletes.end(), buffer.m_deletes.begin(), buffer.m_deletes.end());
+
+		// The archetype is in the top bits, so each one's ids end up next to each other
+		std::sort(deletes.begin(), deletes.end());
+
+		for (auto first = deletes.begin(); first != deletes.end();)
+		{
+			auto archetype = GetArchetypeIndex(*first);
+			auto last = std::find_if(first, deletes.end(), [archetype](std::size_t id) { return GetArchetypeIndex(id) != archetype; });
+
+			VisitStore(archetype, [&]<std::size_t Index>(std::integral_constant<std::size_t, Index>)
+			{
+				std::get<Index>(m_stores).DeleteMany(std::ranges::subrange(first, last));
+			});
+
+			first = last;
+		}
+
+		[&]<std::size_t... Indices>(std::index_sequence<Indices...>)
+		{
+			(PlaybackCreates<Indices>(buffers), ...);
+		}(std::index_sequence_for<TArchetypes...>());
+
+		PlaybackComponentChanges(buffers);
+
+		for (auto& buffer : buffers)
+			buffer.Clear();
+	}
+
+	void Playback(CommandBuffer<TArchetypes...>& buffer)
+	{
+		Playback(std::span(&buffer, 1));
+	}
+
+	// Runs a compaction slice on every store, e.g. once a frame or from a background thread. Stores with open views
+	// are skipped. Returns true when none of them have holes left
+	bool Compact(const CompactionBudget& budget = {})
+	{
+		// Not short-circuiting, every store gets its slice
+		return std::apply([&budget](auto&... store) { return (store.Compact(budget) & ...); }, m_stores);
+	}
+
+	// Budget of the slice that runs when the last view of a store is released
+	void SetCompactionBudget(const CompactionBudget& budget)
+	{
+		std::apply([&budget](auto&... store) { (store.SetCompactionBudget(budget), ...); }, m_stores);
+	}
+
+	// Reorders an archetype's objects by a key of one of their components a few blocks per call, e.g. a Morton key of
+	// their position once a frame. Returns true once the store is in order
+	template<typename TArchetype, typename TComponent, typename TKeyFunc>
+	bool SortBy(TKeyFunc keyFn, std::size_t blockCount = 1)
+	{
+		return std::get<typename TArchetype::StoreType>(m_stores).template SortBy<TComponent>(keyFn, blockCount);
+	}
+
+	template<typename TArchetype>
+	FragmentationStats GetFragmentationStats()
+	{
+		return std::get<typename TArchetype::StoreType>(m_stores).GetFragmentationStats();
+	}
+
+	// Keeps an archetype's blocks on one NUMA node, e.g. the node of the workers that scan it
+	template<typename TArchetype>
+	void SetPreferredNode(std::size_t node)
+	{
+		std::get<typename TArchetype::StoreType>(m_stores).SetPreferredNode(node);
+	}
+
+	static inline constexpr std::size_t NO_COMPONENT = ComponentRegistry::NO_COMPONENT;
+	static inline constexpr std::size_t NO_ARCHETYPE = std::numeric_limits<std::size_t>::max();
+
+	// Adds a component only known at runtime, e.g. from a script. Returns its id, NO_COMPONENT if the name is taken
+	std::size_t RegisterComponentDynamic(ComponentInfo info)
+	{
+		return m_registry.Register(std::move(info));
+	}
+
+	// Lets the dynamic API find a compile time component by name
+	template<typename TComponent>
+	bool NameComponentDynamic(std::string name)
+	{
+		return m_registry.SetName(GetComponentId<TComponent>(), std::move(name));
+	}
+
+	std::size_t FindComponentIdDynamic(std::string_view componentName)
+	{
+		return m_registry.Find(componentName);
+	}
+
+	const ComponentInfo& GetComponentInfoDynamic(std::size_t componentId)
+	{
+		return m_registry.Get(componentId);
+	}
+
+	// Archetype with exactly these components, in any order. A compile time one if it matches, otherwise one is made
+	// at runtime the first time it's asked for. NO_ARCHETYPE for unknown components or once the id layout is full
+	template<std::ranges::input_range TRange>
+	std::size_t FindArchetypeIdDynamic(TRange componentIds) requires std::same_as<std::ranges::range_value_t<TRange>, std::size_t>
+	{
+		std::vector<std::size_t> sorted(std::ranges::begin(componentIds), std::ranges::end(componentIds));
+		std::ranges::sort(sorted);
+		sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+		return FindArchetypeIdSorted(std::move(sorted));
+	}
+
+	// Object with value-initialized components, 0 if there is no such archetype
+	std::size_t CreateDynamic(std::size_t archetypeId)
+	{
+		std::size_t id = 0;
+		VisitStore(archetypeId, [&]<std::size_t Index>(std::integral_constant<std::size_t, Index>)
+		{
+			[&]<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+			{
+				for (auto object : std::get<Index>(m_stores).Emplace(1))
+				{
+					std::apply([&](auto objId, auto&&... components)
+					{
+						id = objId;
+
+						// Recycled blocks still hold the values of deleted objects
+						auto reset = []<typename T>(auto&& component, std::type_identity<T>)
+						{
+							if constexpr (!TagComponent<T>)
+								component = T{};
+						};
+
+						(reset(components, std::type_identity<TComponents>()), ...);
+					}, object);
+				}
+			}(std::type_identity<ArchetypeAt<Index>>());
+		});
+
+		if (auto store = FindDynamicStore(archetypeId))
+			id = store->Create();
+
+		return id;
+	}
+
+	// False if the id is stale
+	bool DeleteDynamic(std::size_t objId)
+	{
+		bool deleted = false;
+		VisitStore(GetArchetypeIndex(objId), [&]<std::size_t Index>(std::integral_constant<std::size_t, Index>)
+		{
+			deleted = std::get<Index>(m_stores).Delete(objId);
+		});
+
+		if (auto store = FindDynamicStore(GetArchetypeIndex(objId)))
+			deleted = store->Delete(objId);
+
+		return deleted;
+	}
+
+	// Component of an object in an archetype made at runtime, null if it doesn't have it or the id is stale. Valid
+	// until the next structural change of the archetype. Compile time archetypes are reached through queries
+	void *GetComponentDynamic(std::size_t objId, std::size_t componentId)
+	{
+		auto store = FindDynamicStore(GetArchetypeIndex(objId));
+		if (!store)
+			return nullptr;
+
+		auto index = store->FindIndex(objId);
+		auto column = store->FindColumn(componentId);
+
+		return index == DynamicStore::NO_INDEX || column == DynamicStore::NO_COLUMN ? nullptr : store->Get(index, column);
+	}
+
+	// Id of a component for the dynamic API
+	template<typename TComponent>
+	static constexpr std::size_t GetComponentId()
+	{
+		return Components::template IndexOf<TComponent>;
+	}
+
+	// Like AddComponent, the added component is value-initialized. Objects move between compile time and runtime
+	// archetypes as needed
+	std::size_t AddComponentDynamic(std::size_t objId, std::size_t componentId)
+	{
+		std::size_t newId = 0;
+		ChangeComponentsDynamic(std::span(&objId, 1), std::span(&newId, 1), componentId, true);
+		return newId;
+	}
+
+	std::size_t RemoveComponentDynamic(std::size_t objId, std::size_t componentId)
+	{
+		std::size_t newId = 0;
+		ChangeComponentsDynamic(std::span(&objId, 1), std::span(&newId, 1), componentId, false);
+		return newId;
+	}
+
+	std::vector<std::size_t> AddComponentsDynamic(std::span<const std::size_t> objIds, std::size_t componentId)
+	{
+		std::vector<std::size_t> newIds(objIds.size());
+		ChangeComponentsDynamic(objIds, newIds, componentId, true);
+		return newIds;
+	}
+
+	std::vector<std::size_t> RemoveComponentsDynamic(std::span<const std::size_t> objIds, std::size_t componentId)
+	{
+		std::vector<std::size_t> newIds(objIds.size());
+		ChangeComponentsDynamic(objIds, newIds, componentId, false);
+		return newIds;
+	}
+
+	// Query over the runtime archetypes with all of componentIds and none of excludedIds. The matching archetypes
+	// are found once and kept up to date as archetypes are added, so running it again only walks their objects.
+	// Compile time archetypes are left to the static queries. Returns an id for RunQueryDynamic
+	std::size_t FindQueryDynamic(std::span<const std::size_t> componentIds, std::span<const std::size_t> excludedIds = {})
+	{
+		std::vector<std::size_t> excluded(excludedIds.begin(), excludedIds.end());
+		std::ranges::sort(excluded);
+
+		auto key = std::pair(std::vector<std::size_t>(componentIds.begin(), componentIds.end()), std::move(excluded));
+		auto [found, added] = m_dynamicQueryIds.try_emplace(key, m_dynamicQueries.size());
+
+		if (added)
+		{
+			auto& query = m_dynamicQueries.emplace_back();
+			query.Components = std::move(key.first);
+			query.Excluded = std::move(key.second);
+		}
+
+		return found->second;
+	}
+
+	// Calls func with a DynamicChunk per run of matching objects, its columns in the order of the query's components
+	template<typename TFunc>
+	void RunQueryDynamic(std::size_t queryId, TFunc func)
+	{
+		auto& query = m_dynamicQueries[queryId];
+		UpdateDynamicQuery(query);
+
+		for (auto& match : query.Matches)
+			m_dynamicStores[match.Store].ForEachChunk(match.Columns, func);
+	}
+private:
+	// In the store's component order
+	template<std::size_t Index>
+	using ArchetypeAt = std::tuple_element_t<Index, std::tuple<TArchetypes...>>::Canonical;
+
+	// Index of the archetype with the same components, the archetype count if there is none
+	template<typename TArchetype>
+	static inline constexpr std::size_t FindArchetypeIndex = []()
+	{
+		std::size_t index = 0;
+		bool found = false;
+		((found = found || TArchetype::template Equals<TArchetypes>, index += !found), ...);
+		return index;
+	}();
+
+	static_assert([]()
+	{
+		std::size_t index = 0;
+		return ((FindArchetypeIndex<TArchetypes> == index++) && ...);
+	}(), "Archetypes with the same components share a store, list them once!");
+
+	// Calls func with the archetype index as an integral_constant, false if there is no such archetype
+	template<std::size_t Index = 0, typename TFunc>
+	bool VisitStore(std::size_t archetypeIndex, TFunc&& func)
+	{
+		if constexpr (Index < sizeof...(TArchetypes))
+		{
+			if (archetypeIndex != Index)
+				return VisitStore<Index + 1>(archetypeIndex, func);
+
+			func(std::integral_constant<std::size_t, Index>());
+			return true;
+		}
+		else
+			return false;
+	}
+
+	template<std::size_t Index>
+	void PlaybackCreates(std::span<CommandBuffer<TArchetypes...>> buffers)
+	{
+		std::size_t count = 0;
+		for (auto& buffer : buffers)
+			count += std::get<Index>(buffer.m_creates).size();
+
+		if (count == 0)
+			return;
+
+		auto buffer = buffers.begin();
+		std::size_t created = 0;
+
+		for (auto object : std::get<Index>(m_stores).Emplace(count))
+		{
+			while (created == std::get<Index>(buffer->m_creates).size())
+			{
+				++buffer;
+				created = 0;
+			}
+
+			auto& values = std::get<Index>(buffer->m_creates)[created++];
+			std::apply([&values](auto&&, auto&&... components)
+			{
+				std::apply([&](auto&... value) { ((components = value), ...); }, values);
+			}, object);
+		}
+	}
+
+	using Components = CommandBufferType::Components;
+	using ComponentMask = std::bitset<std::tuple_size_v<typename Components::Tuple>>;
+
+	// Position of the relation among the relation components, their count for anything else
+	template<typename TComponent>
+	static inline constexpr std::size_t RelationIndexOf = []<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+	{
+		std::size_t index = 0;
+		bool found = false;
+		((found = found || std::same_as<TComponents, TComponent>, index += !found && RelationComponent<TComponents>), ...);
+		return index;
+	}(std::type_identity<Components>());
+
+	bool IsAlive(std::size_t objId)
+	{
+		bool alive = false;
+		VisitStore(GetArchetypeIndex(objId), [&]<std::size_t Index>(std::integral_constant<std::size_t, Index>)
+		{
+			auto& store = std::get<Index>(m_stores);
+			alive = store.FindIndex(objId) != store.NO_INDEX;
+		});
+
+		return alive;
+	}
+
+	// Reads the relation from the blocks written since the last update. Deletes don't write blocks, and objects
+	// that moved to another archetype show up under their new id, so old ids are pruned as the index grows
+	template<RelationComponent TRelation>
+	RelationIndex& UpdateRelationIndex()
+	{
+		auto& index = m_relationIndices[RelationIndexOf<TRelation>];
+		auto version = GetChangeVersion();
+
+		std::vector<RelationIndex::Pair> changed;
+		for (auto [id, relation] : RunQuerySince<typename Query::template Read<std::size_t, TRelation>::template Changed<TRelation>>(index.GetVersion()))
+			changed.emplace_back(relation.Target, id);
+
+		auto changes = index.Update(changed);
+		index.SetVersion(version);
+		auto removed = index.Prune([this](std::size_t sourceId) { return IsAlive(sourceId); });
+
+		auto& levels = m_relationLevels[RelationIndexOf<TRelation>];
+		if (levels.IsBuilt())
+		{
+			levels.Remove(removed);
+			levels.Update(changes, index);
+		}
+
+		return index;
+	}
+
+	// Levels are only kept up to date once a LevelTraverse query asked for them
+	template<RelationComponent TRelation>
+	RelationLevels& UpdateRelationLevels()
+	{
+		auto& index = UpdateRelationIndex<TRelation>();
+		auto& levels = m_relationLevels[RelationIndexOf<TRelation>];
+
+		if (!levels.IsBuilt())
+			levels.Rebuild(index);
+
+		return levels;
+	}
+
+	struct ComponentChange
+	{
+		std::size_t ObjId;
+		std::size_t Order;
+		std::size_t Component;
+		const void *Value; // Null for removes
+	};
+
+	template<typename TArchetype>
+	static ComponentMask GetComponentMask()
+	{
+		return []<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+		{
+			ComponentMask mask;
+			(mask.set(Components::template IndexOf<TComponents>), ...);
+			return mask;
+		}(std::type_identity<TArchetype>());
+	}
+
+	// Unknown ids give an empty mask, so nothing moves
+	static ComponentMask GetComponentMask(std::size_t componentId)
+	{
+		ComponentMask mask;
+		if (componentId < mask.size())
+			mask.set(componentId);
+
+		return mask;
+	}
+
+	static const std::array<ComponentMask, sizeof...(TArchetypes)>& GetArchetypeMasks()
+	{
+		static const std::array<ComponentMask, sizeof...(TArchetypes)> masks = { GetComponentMask<TArchetypes>()... };
+		return masks;
+	}
+
+	// Archetype index the object would move to, the archetype count if the storage doesn't have it
+	static std::size_t FindTargetArchetype(std::size_t source, const ComponentMask& addMask, const ComponentMask& removeMask)
+	{
+		auto& masks = GetArchetypeMasks();
+		return std::ranges::find(masks, (masks[source] | addMask) & ~removeMask) - masks.begin();
+	}
+
+	// Gives the objects the components in addMask, set from added if among them, and takes away those in removeMask,
+	// moving each archetype's objects as one group
+	template<typename... TAdded>
+	void MoveObjects(
+		std::span<const std::size_t> objIds, std::span<std::size_t> newIds,
+		const ComponentMask& addMask, const ComponentMask& removeMask, const TAdded&... added
+	)
+	{
+		// Sorted ids put each archetype's objects next to each other
+		std::vector<std::size_t> order(objIds.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::ranges::sort(order, {}, [objIds](std::size_t position) { return objIds[position]; });
+
+		std::vector<std::size_t> groupIds;
+		std::vector<std::size_t> groupNewIds;
+
+		for (auto first = order.begin(); first != order.end();)
+		{
+			auto source = GetArchetypeIndex(objIds[*first]);
+			auto last = std::find_if(first, order.end(), [&](std::size_t position) { return GetArchetypeIndex(objIds[position]) != source; });
+
+			groupIds.clear();
+			for (auto position = first; position != last; ++position)
+				groupIds.push_back(objIds[*position]);
+
+			groupNewIds.assign(groupIds.size(), 0);
+
+			if (source < sizeof...(TArchetypes))
+			{
+				VisitStore(source, [&]<std::size_t Source>(std::integral_constant<std::size_t, Source>)
+				{
+					VisitStore(FindTargetArchetype(source, addMask, removeMask), [&]<std::size_t Target>(std::integral_constant<std::size_t, Target>)
+					{
+						MoveGroup<Source, Target>(groupIds, groupNewIds, added...);
+					});
+				});
+			}
+
+			for (std::size_t i = 0; first != last; ++first, ++i)
+				newIds[*first] = groupNewIds[i];
+		}
+	}
+
+	template<std::size_t Source, std::size_t Target, typename... TAdded>
+	void MoveGroup(std::span<const std::size_t> ids, std::span<std::size_t> newIds, const TAdded&... added)
+	{
+		if constexpr (Source == Target)
+		{
+			// Nothing to move, added components the archetype already has are set in place
+			for (std::size_t i = 0; i < ids.size(); ++i)
+			{
+				for (auto [id] : std::get<Source>(m_stores).template GetViewAt<const std::size_t>(ids[i]))
+					newIds[i] = id;
+
+				auto setAdded = [&]<typename T>(const T& value)
+				{
+					if constexpr (ArchetypeAt<Source>::template Contains<T>)
+					{
+						for (auto [component] : std::get<Source>(m_stores).template GetViewAt<T>(ids[i]))
+							component = value;
+					}
+				};
+
+				(setAdded(added), ...);
+			}
+		}
+		else
+			std::get<Target>(m_stores).MoveFrom(std::get<Source>(m_stores), ids, newIds, added...);
+	}
+
+	struct ObjectMove
+	{
+		std::size_t Source;
+		std::size_t Target;
+		std::size_t ObjId;
+		std::span<const ComponentChange> Changes;
+	};
+
+	void PlaybackComponentChanges(std::span<CommandBuffer<TArchetypes...>> buffers)
+	{
+		std::vector<ComponentChange> changes;
+		std::size_t firstOrder = 0;
+
+		for (auto& buffer : buffers)
+		{
+			std::apply([&](auto&... commands) { (GatherComponentChanges(commands, firstOrder, changes), ...); }, buffer.m_componentCommands);
+			firstOrder += buffer.m_sequence;
+		}
+
+		std::ranges::sort(changes, {}, [](const ComponentChange& change) { return std::pair(change.ObjId, change.Order); });
+
+		std::vector<ObjectMove> moves;
+
+		for (auto first = changes.begin(); first != changes.end();)
+		{
+			auto objId = first->ObjId;
+			auto last = std::find_if(first, changes.end(), [objId](const ComponentChange& change) { return change.ObjId != objId; });
+			auto source = GetArchetypeIndex(objId);
+
+			if (source < sizeof...(TArchetypes))
+			{
+				// The last change of a component decides whether the object ends up with it
+				ComponentMask added;
+				ComponentMask removed;
+
+				for (auto change = first; change != last; ++change)
+				{
+					added.set(change->Component, change->Value != nullptr);
+					removed.set(change->Component, change->Value == nullptr);
+				}
+
+				moves.push_back({ source, FindTargetArchetype(source, added, removed), objId, std::span(first, last) });
+			}
+
+			first = last;
+		}
+
+		// Objects going between the same two archetypes move as one group
+		std::ranges::stable_sort(moves, {}, [](const ObjectMove& move) { return std::pair(move.Source, move.Target); });
+
+		for (auto first = moves.begin(); first != moves.end();)
+		{
+			auto last = std::find_if(first, moves.end(), [first](const ObjectMove& move) { return move.Source != first->Source || move.Target != first->Target; });
+
+			VisitStore(first->Source, [&]<std::size_t Source>(std::integral_constant<std::size_t, Source>)
+			{
+				VisitStore(first->Target, [&]<std::size_t Target>(std::integral_constant<std::size_t, Target>)
+				{
+					PlaybackMoves<Source, Target>(std::span(first, last));
+				});
+			});
+
+			first = last;
+		}
+	}
+
+	template<typename TCommands>
+	static void GatherComponentChanges(const TCommands& commands, std::size_t firstOrder, std::vector<ComponentChange>& changes)
+	{
+		constexpr auto component = Components::template IndexOf<typename TCommands::Component>;
+
+		for (auto& add : commands.Adds)
+			changes.push_back({ add.ObjId, firstOrder + add.Sequence, component, &add.Value });
+
+		for (auto& remove : commands.Removes)
+			changes.push_back({ remove.ObjId, firstOrder + remove.Sequence, component, nullptr });
+	}
+
+	// Last added value of the component among an object's changes, null if it has none
+	template<typename T>
+	static const T *FindAddedValue(std::span<const ComponentChange> changes)
+	{
+		for (auto change = changes.rbegin(); change != changes.rend(); ++change)
+		{
+			if (change->Component == Components::template IndexOf<T>)
+				return static_cast<const T *>(change->Value);
+		}
+
+		return nullptr;
+	}
+
+	// Moves the group's objects between the archetypes, then sets the values they were added with
+	template<std::size_t Source, std::size_t Target>
+	void PlaybackMoves(std::span<const ObjectMove> moves)
+	{
+		[&]<typename... TTarget>(std::type_identity<Archetype<TTarget...>>)
+		{
+			auto setAdded = [](auto& object, std::span<const ComponentChange> changes)
+			{
+				((FindAddedValue<TTarget>(changes) ? void(std::get<1 + ArchetypeAt<Target>::template IndexOf<TTarget>>(object) = *FindAddedValue<TTarget>(changes)) : void()), ...);
+			};
+
+			if constexpr (Source == Target)
+			{
+				for (auto& move : moves)
+				{
+					for (auto object : std::get<Target>(m_stores).template GetViewAt<const std::size_t, TTarget...>(move.ObjId))
+						setAdded(object, move.Changes);
+				}
+			}
+			else
+			{
+				std::vector<std::size_t> ids;
+				for (auto& move : moves)
+					ids.push_back(move.ObjId);
+
+				std::vector<std::size_t> newIds(ids.size());
+				auto view = std::get<Target>(m_stores).MoveFrom(std::get<Source>(m_stores), ids, newIds);
+
+				std::unordered_map<std::size_t, std::span<const ComponentChange>> changesOf;
+				for (std::size_t i = 0; i < moves.size(); ++i)
+				{
+					if (newIds[i] != 0)
+						changesOf[newIds[i]] = moves[i].Changes;
+				}
+
+				for (auto object : view)
+					setAdded(object, changesOf[std::get<0>(object)]);
+			}
+		}(std::type_identity<ArchetypeAt<Target>>());
+	}
+
+	static inline constexpr std::size_t MAX_ARCHETYPES = 1ull << (63 - ARCHETYPE_ID_SHIFT);
+
+	struct DynamicQueryMatch
+	{
+		std::size_t Store;
+		std::vector<std::size_t> Columns; // Of the query's components
+	};
+
+	struct DynamicQuery
+	{
+		std::vector<std::size_t> Components;
+		std::vector<std::size_t> Excluded;
+		std::vector<DynamicQueryMatch> Matches;
+		std::size_t CheckedStores = 0; // Stores are only ever added, the ones past this haven't been matched yet
+	};
+
+	// Null for compile time archetypes and unknown indices
+	DynamicStore *FindDynamicStore(std::size_t archetypeIndex)
+	{
+		if (archetypeIndex < sizeof...(TArchetypes) || archetypeIndex - sizeof...(TArchetypes) >= m_dynamicStores.size())
+			return nullptr;
+
+		return &m_dynamicStores[archetypeIndex - sizeof...(TArchetypes)];
+	}
+
+	std::size_t FindArchetypeIdSorted(std::vector<std::size_t> componentIds)
+	{
+		if (!componentIds.empty() && componentIds.back() >= m_registry.GetCount())
+			return NO_ARCHETYPE;
+
+		if (componentIds.empty() || componentIds.back() < ComponentMask().size())
+		{
+			ComponentMask mask;
+			for (auto componentId : componentIds)
+				mask.set(componentId);
+
+			auto& masks = GetArchetypeMasks();
+			auto found = std::ranges::find(masks, mask);
+			if (found != masks.end())
+				return found - masks.begin();
+		}
+
+		auto [found, added] = m_dynamicArchetypes.try_emplace(componentIds, sizeof...(TArchetypes) + m_dynamicStores.size());
+		if (added)
+		{
+			if (found->second >= MAX_ARCHETYPES)
+			{
+				m_dynamicArchetypes.erase(found);
+				return NO_ARCHETYPE;
+			}
+
+			m_dynamicStores.emplace_back(found->second, std::move(componentIds), m_registry);
+		}
+
+		return found->second;
+	}
+
+	// Sorted, empty for unknown archetypes
+	std::vector<std::size_t> GetComponentIdsOf(std::size_t archetypeIndex)
+	{
+		if (auto store = FindDynamicStore(archetypeIndex))
+			return std::vector<std::size_t>(store->GetComponentIds().begin(), store->GetComponentIds().end());
+
+		std::vector<std::size_t> componentIds;
+		if (archetypeIndex < sizeof...(TArchetypes))
+		{
+			auto& mask = GetArchetypeMasks()[archetypeIndex];
+			for (std::size_t componentId = 0; componentId < mask.size(); ++componentId)
+			{
+				if (mask[componentId])
+					componentIds.push_back(componentId);
+			}
+		}
+
+		return componentIds;
+	}
+
+	bool IsAliveDynamic(std::size_t objId)
+	{
+		if (auto store = FindDynamicStore(GetArchetypeIndex(objId)))
+			return store->FindIndex(objId) != DynamicStore::NO_INDEX;
+
+		return IsAlive(objId);
+	}
+
+	// Objects going between compile time archetypes move in groups through MoveObjects, the others one at a time
+	void ChangeComponentsDynamic(std::span<const std::size_t> objIds, std::span<std::size_t> newIds, std::size_t componentId, bool add)
+	{
+		std::vector<std::size_t> groupPositions;
+		std::vector<std::size_t> groupIds;
+
+		for (std::size_t i = 0; i < objIds.size(); ++i)
+		{
+			newIds[i] = 0;
+			if (!IsAliveDynamic(objIds[i]))
+				continue;
+
+			auto source = GetArchetypeIndex(objIds[i]);
+			auto componentIds = GetComponentIdsOf(source);
+			auto position = std::ranges::lower_bound(componentIds, componentId);
+			auto has = position != componentIds.end() && *position == componentId;
+
+			if (add && !has)
+				componentIds.insert(position, componentId);
+			else if (!add && has)
+				componentIds.erase(position);
+
+			auto target = FindArchetypeIdSorted(std::move(componentIds));
+			if (target == NO_ARCHETYPE)
+				continue;
+
+			if (source < sizeof...(TArchetypes) && target < sizeof...(TArchetypes))
+			{
+				groupPositions.push_back(i);
+				groupIds.push_back(objIds[i]);
+			}
+			else
+				newIds[i] = MoveObjectDynamic(objIds[i], source, target);
+		}
+
+		if (groupIds.empty())
+			return;
+
+		std::vector<std::size_t> groupNewIds(groupIds.size());
+		auto mask = GetComponentMask(componentId);
+		MoveObjects(groupIds, groupNewIds, add ? mask : ComponentMask(), add ? ComponentMask() : mask);
+
+		for (std::size_t i = 0; i < groupIds.size(); ++i)
+			newIds[groupPositions[i]] = groupNewIds[i];
+	}
+
+	// Moves a live object to an archetype when at least one of the two was made at runtime. Components both have
+	// are moved over, the others are value-initialized
+	std::size_t MoveObjectDynamic(std::size_t objId, std::size_t source, std::size_t target)
+	{
+		if (source == target)
+			return objId;
+
+		auto sourceStore = FindDynamicStore(source);
+		auto targetStore = FindDynamicStore(target);
+		std::size_t newId = 0;
+
+		if (sourceStore && targetStore)
+		{
+			auto index = sourceStore->FindIndex(objId);
+			newId = targetStore->Create([&](std::size_t column, void *object)
+			{
+				auto sourceColumn = sourceStore->FindColumn(targetStore->GetComponentIds()[column]);
+				if (sourceColumn == DynamicStore::NO_COLUMN)
+					return false;
+
+				targetStore->GetColumn(column).Move(object, sourceStore->Get(index, sourceColumn));
+				return true;
+			});
+
+			sourceStore->Delete(objId);
+		}
+		else if (targetStore)
+		{
+			VisitStore(source, [&]<std::size_t Source>(std::integral_constant<std::size_t, Source>)
+			{
+				auto& store = std::get<Source>(m_stores);
+				newId = targetStore->Create([&](std::size_t column, void *object)
+				{
+					bool moved = false;
+					[&]<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+					{
+						auto moveComponent = [&]<typename T>(std::type_identity<T>)
+						{
+							if (moved || targetStore->GetComponentIds()[column] != GetComponentId<T>())
+								return;
+
+							for (auto [value] : store.template GetViewAt<const T>(objId))
+							{
+								new(object) T(static_cast<T>(value));
+								moved = true;
+							}
+						};
+
+						(moveComponent(std::type_identity<TComponents>()), ...);
+					}(std::type_identity<ArchetypeAt<Source>>());
+
+					return moved;
+				});
+
+				store.Delete(objId);
+			});
+		}
+		else if (sourceStore)
+		{
+			auto index = sourceStore->FindIndex(objId);
+			VisitStore(target, [&]<std::size_t Target>(std::integral_constant<std::size_t, Target>)
+			{
+				[&]<typename... TComponents>(std::type_identity<Archetype<TComponents...>>)
+				{
+					for (auto object : std::get<Target>(m_stores).Emplace(1))
+					{
+						std::apply([&](auto id, auto&&... components)
+						{
+							newId = id;
+
+							auto moveComponent = [&]<typename T>(auto&& component, std::type_identity<T>)
+							{
+								auto column = sourceStore->FindColumn(GetComponentId<T>());
+								if (column != DynamicStore::NO_COLUMN)
+									component = std::move(*static_cast<T *>(sourceStore->Get(index, column)));
+								else if constexpr (!TagComponent<T>)
+									component = T{};
+							};
+
+							(moveComponent(components, std::type_identity<TComponents>()), ...);
+						}, object);
+					}
+				}(std::type_identity<ArchetypeAt<Target>>());
+			});
+
+			sourceStore->Delete(objId);
+		}
+
+		return newId;
+	}
+
+	void UpdateDynamicQuery(DynamicQuery& query)
+	{
+		for (; query.CheckedStores < m_dynamicStores.size(); ++query.CheckedStores)
+		{
+			auto& store = m_dynamicStores[query.CheckedStores];
+
+			auto excluded = std::ranges::any_of(query.Excluded, [&store](std::size_t componentId) { return store.FindColumn(componentId) != DynamicStore::NO_COLUMN; });
+			if (excluded)
+				continue;
+
+			DynamicQueryMatch match;
+			match.Store = query.CheckedStores;
+			for (auto componentId : query.Components)
+				match.Columns.push_back(store.FindColumn(componentId));
+
+			if (std::ranges::find(match.Columns, DynamicStore::NO_COLUMN) == match.Columns.end())
+				query.Matches.push_back(std::move(match));
+		}
+	}
+
+	std::tuple<typename TArchetypes::StoreType...> m_stores;
+	std::array<RelationIndex, RelationIndexOf<void>> m_relationIndices;
+	std::array<RelationLevels, RelationIndexOf<void>> m_relationLevels;
+	ChangeClock m_changeClock;
+
+	// Compile time components come first, so their registry ids are the ones GetComponentId gives
+	ComponentRegistry m_registry;
+	std::deque<DynamicStore> m_dynamicStores; // Archetype index is sizeof...(TArchetypes) + position
+	std::map<std::vector<std::size_t>, std::size_t> m_dynamicArchetypes;
+	std::vector<DynamicQuery> m_dynamicQueries;
+	std::map<std::pair<std::vector<std::size_t>, std::vector<std::size_t>>, std::size_t> m_dynamicQueryIds;
 };
\ No newline at end of file
@@ -0,0 +1,11 @@
+#include "EpochReclaimer.h"
+
+std::atomic<EpochReclaimer::ThreadRecord *> EpochReclaimer::m_records = nullptr;
+std::atomic_uint64_t EpochReclaimer::m_globalEpoch = 0;
+std::atomic_size_t EpochReclaimer::m_reclaimedCount = 0;
+
+std::mutex EpochReclaimer::m_orphanLock;
+std::vector<std::pair<std::uint64_t, EpochReclaimer::Retired>> EpochReclaimer::m_orphans;
+std::atomic_size_t EpochReclaimer::m_orphanCount = 0;
+
+thread_local EpochReclaimer::ThreadHandle EpochReclaimer::m_thread;
\ No newline at end of file
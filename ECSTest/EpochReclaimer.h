@@ -0,0 +1,332 @@
+#pragma once
+
+#include "MemoryPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+const size_t EPOCH_BAGS = 3;
+const size_t EPOCH_COLLECT_THRESHOLD = 64; // Retired blocks per thread before trying to advance the epoch
+
+struct EpochStats
+{
+	std::uint64_t Epoch;
+	std::size_t PendingBlocks;   // Retired but possibly still visible to a reader
+	std::size_t ReclaimedBlocks; // Returned to the pool since startup
+};
+
+// Epoch-based reclamation for RCU blocks. Readers pin the current epoch with a Guard, writers retire unlinked blocks,
+// and a block is returned to the pool once the global epoch has advanced twice past the epoch it was retired in.
+// A thread announces the oldest epoch any of its guards pinned, so short-lived guards (one per block visited)
+// let the epoch advance even while a long query is running.
+class EpochReclaimer
+{
+public:
+	class Guard
+	{
+	public:
+		Guard();
+		~Guard();
+
+		// Copies pin the same epoch as the original, on the same thread
+		Guard(const Guard& other);
+		Guard& operator=(const Guard& other);
+	private:
+		std::uint64_t m_epoch;
+	};
+
+	template<BlockSized T>
+	static void Retire(MemoryPool::Ptr<T>&& block);
+
+	// Advances the epoch if every active reader has caught up and frees whatever became unreachable
+	static void Collect();
+
+	// Frees every block retired by this thread or by exited threads, only safe once no readers remain
+	static void Drain();
+
+	static EpochStats GetStats();
+private:
+	static const std::uint64_t ACTIVE_BIT = 1ull << 63;
+
+	struct Retired
+	{
+		void *Block;
+		void (*Free)(void *);
+	};
+
+	struct ThreadRecord
+	{
+		std::atomic_uint64_t Epoch = 0; // Announced epoch with ACTIVE_BIT set while inside a guard
+		std::atomic_bool InUse = false;
+		std::atomic_size_t PendingCount = 0;
+		ThreadRecord *Next = nullptr;
+
+		// Live guards can only span two consecutive epochs, so they are counted per bag
+		std::size_t PinCount[EPOCH_BAGS] = {};
+		std::uint64_t PinEpoch[EPOCH_BAGS] = {};
+
+		std::vector<Retired> Limbo[EPOCH_BAGS];
+		std::uint64_t LimboEpoch[EPOCH_BAGS] = {};
+	};
+
+	// Releases the thread's record and hands its retired blocks over when the thread exits
+	struct ThreadHandle
+	{
+		ThreadRecord *Record = nullptr;
+
+		~ThreadHandle();
+	};
+
+	static std::atomic<ThreadRecord *> m_records;
+	static std::atomic_uint64_t m_globalEpoch;
+	static std::atomic_size_t m_reclaimedCount;
+
+	static std::mutex m_orphanLock;
+	static std::vector<std::pair<std::uint64_t, Retired>> m_orphans;
+	static std::atomic_size_t m_orphanCount;
+
+	static thread_local ThreadHandle m_thread;
+
+	template<BlockSized T>
+	static void FreeBlock(void *block);
+
+	static ThreadRecord& GetRecord();
+	static std::uint64_t Enter();
+	static void Leave(std::uint64_t epoch);
+	static void Announce(ThreadRecord& record);
+	static bool TryAdvance();
+	static void FreeBag(ThreadRecord& record, std::size_t bag);
+	static void CollectOrphans(bool force);
+};
+
+inline EpochReclaimer::Guard::Guard() : m_epoch(Enter())
+{
+}
+
+inline EpochReclaimer::Guard::~Guard()
+{
+	Leave(m_epoch);
+}
+
+inline EpochReclaimer::Guard::Guard(const Guard& other) : m_epoch(other.m_epoch)
+{
+	++GetRecord().PinCount[m_epoch % EPOCH_BAGS];
+}
+
+inline EpochReclaimer::Guard& EpochReclaimer::Guard::operator=(const Guard& other)
+{
+	++GetRecord().PinCount[other.m_epoch % EPOCH_BAGS];
+	Leave(m_epoch);
+	m_epoch = other.m_epoch;
+
+	return *this;
+}
+
+template<BlockSized T>
+inline void EpochReclaimer::Retire(MemoryPool::Ptr<T>&& block)
+{
+	auto& record = GetRecord();
+
+	auto epoch = m_globalEpoch.load();
+	auto bag = epoch % EPOCH_BAGS;
+
+	// A bag is reused three epochs later, by which point everything in it is unreachable
+	if (record.LimboEpoch[bag] != epoch)
+	{
+		FreeBag(record, bag);
+		record.LimboEpoch[bag] = epoch;
+	}
+
+	record.Limbo[bag].push_back({ block.Release(), &FreeBlock<T> });
+
+	[[unlikely]]
+	if (++record.PendingCount >= EPOCH_COLLECT_THRESHOLD)
+		Collect();
+}
+
+inline void EpochReclaimer::Collect()
+{
+	TryAdvance();
+
+	auto& record = GetRecord();
+	auto epoch = m_globalEpoch.load();
+
+	for (std::size_t bag = 0; bag < EPOCH_BAGS; ++bag)
+	{
+		if (record.LimboEpoch[bag] + 2 <= epoch)
+			FreeBag(record, bag);
+	}
+
+	if (m_orphanCount.load(std::memory_order_relaxed) > 0)
+		CollectOrphans(false);
+}
+
+inline void EpochReclaimer::Drain()
+{
+	auto& record = GetRecord();
+
+	for (std::size_t bag = 0; bag < EPOCH_BAGS; ++bag)
+		FreeBag(record, bag);
+
+	CollectOrphans(true);
+}
+
+inline EpochStats EpochReclaimer::GetStats()
+{
+	EpochStats stats = { m_globalEpoch.load(), m_orphanCount.load(), m_reclaimedCount.load() };
+
+	for (auto record = m_records.load(); record; record = record->Next)
+		stats.PendingBlocks += record->PendingCount.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+template<BlockSized T>
+inline void EpochReclaimer::FreeBlock(void *block)
+{
+	MemoryPool::Ptr<T> ptr(static_cast<T *>(block));
+}
+
+inline EpochReclaimer::ThreadRecord& EpochReclaimer::GetRecord()
+{
+	[[likely]]
+	if (m_thread.Record)
+		return *m_thread.Record;
+
+	// Reuse the record of an exited thread before growing the list
+	for (auto record = m_records.load(); record; record = record->Next)
+	{
+		bool inUse = false;
+		if (record->InUse.compare_exchange_strong(inUse, true))
+		{
+			m_thread.Record = record;
+			return *record;
+		}
+	}
+
+	auto record = new ThreadRecord;
+	record->InUse = true;
+	record->Next = m_records.load();
+	while (!m_records.compare_exchange_weak(record->Next, record));
+
+	m_thread.Record = record;
+	return *record;
+}
+
+inline std::uint64_t EpochReclaimer::Enter()
+{
+	auto& record = GetRecord();
+
+	auto epoch = m_globalEpoch.load();
+
+	while (true)
+	{
+		auto bag = epoch % EPOCH_BAGS;
+
+		// This epoch (or an older one) is already announced
+		if (record.PinCount[bag]++ > 0)
+			return epoch;
+
+		record.PinEpoch[bag] = epoch;
+		Announce(record);
+
+		// Retry if the epoch moved before the announcement became visible
+		auto current = m_globalEpoch.load();
+		if (current == epoch)
+			return epoch;
+
+		--record.PinCount[bag];
+		epoch = current;
+	}
+}
+
+inline void EpochReclaimer::Leave(std::uint64_t epoch)
+{
+	auto& record = GetRecord();
+
+	if (--record.PinCount[epoch % EPOCH_BAGS] == 0)
+		Announce(record);
+}
+
+inline void EpochReclaimer::Announce(ThreadRecord& record)
+{
+	std::uint64_t announced = 0;
+
+	for (std::size_t bag = 0; bag < EPOCH_BAGS; ++bag)
+	{
+		if (record.PinCount[bag] > 0 && (announced == 0 || record.PinEpoch[bag] < (announced & ~ACTIVE_BIT)))
+			announced = record.PinEpoch[bag] | ACTIVE_BIT;
+	}
+
+	record.Epoch.store(announced);
+}
+
+inline bool EpochReclaimer::TryAdvance()
+{
+	auto epoch = m_globalEpoch.load();
+
+	for (auto record = m_records.load(); record; record = record->Next)
+	{
+		auto announced = record->Epoch.load();
+		if ((announced & ACTIVE_BIT) && (announced & ~ACTIVE_BIT) != epoch)
+			return false;
+	}
+
+	return m_globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+inline void EpochReclaimer::FreeBag(ThreadRecord& record, std::size_t bag)
+{
+	auto& limbo = record.Limbo[bag];
+
+	for (auto& retired : limbo)
+		retired.Free(retired.Block);
+
+	record.PendingCount -= limbo.size();
+	m_reclaimedCount += limbo.size();
+	limbo.clear();
+}
+
+inline void EpochReclaimer::CollectOrphans(bool force)
+{
+	std::lock_guard lock(m_orphanLock);
+
+	auto epoch = m_globalEpoch.load();
+	auto freed = std::partition(m_orphans.begin(), m_orphans.end(), [&](auto& orphan)
+	{
+		return !force && orphan.first + 2 > epoch;
+	});
+
+	for (auto cur = freed; cur != m_orphans.end(); ++cur)
+		cur->second.Free(cur->second.Block);
+
+	auto count = m_orphans.end() - freed;
+	m_orphanCount -= count;
+	m_reclaimedCount += count;
+	m_orphans.erase(freed, m_orphans.end());
+}
+
+inline EpochReclaimer::ThreadHandle::~ThreadHandle()
+{
+	if (!Record)
+		return;
+
+	{
+		std::lock_guard lock(m_orphanLock);
+
+		for (std::size_t bag = 0; bag < EPOCH_BAGS; ++bag)
+		{
+			for (auto& retired : Record->Limbo[bag])
+				m_orphans.emplace_back(Record->LimboEpoch[bag], retired);
+
+			m_orphanCount += Record->Limbo[bag].size();
+			Record->Limbo[bag].clear();
+		}
+	}
+
+	Record->PendingCount = 0;
+	std::fill_n(Record->PinCount, EPOCH_BAGS, 0);
+	Record->Epoch = 0;
+	Record->InUse = false;
+}
@@ -1,3 +1,212 @@
 #include "MemoryPool.h"
 
-MemoryPool *MemoryPool::m_globalPool = nullptr;
\ No newline at end of file
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#endif
+
+MemoryPool *MemoryPool::m_globalPool = nullptr;
+std::size_t MemoryPool::m_lastGeneration = 0;
+thread_local MemoryPool::Magazine MemoryPool::m_magazines[MAX_NUMA_NODES][BLOCK_SIZE_CLASSES];
+thread_local std::size_t MemoryPool::m_threadNode = ANY_NUMA_NODE;
+thread_local bool MemoryPool::m_threadNodeBound = false;
+
+static std::size_t AlignUp(std::size_t value, std::size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static std::byte *ReserveRegion(std::size_t size, HugePageMode& hugePages)
+{
+#ifdef _WIN32
+	// Large pages on Windows can't be reserved separately from being committed, so only regular pages are used
+	hugePages = HugePageMode::None;
+	return reinterpret_cast<std::byte *>(VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+#ifdef MAP_HUGETLB
+	if (hugePages == HugePageMode::Explicit)
+	{
+		// Without MAP_NORESERVE the huge pages are reserved now, so this fails when there aren't enough of them
+		// instead of the first write raising SIGBUS
+		auto region = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (region != MAP_FAILED)
+			return reinterpret_cast<std::byte *>(region);
+	}
+#endif
+
+	if (hugePages == HugePageMode::Explicit)
+		hugePages = HugePageMode::Advise;
+
+	// Over-reserve so the region can be aligned to a huge page boundary
+	auto region = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_NONE, flags, -1, 0);
+	if (region == MAP_FAILED)
+		return nullptr;
+
+	auto begin = reinterpret_cast<std::uintptr_t>(region);
+	auto alignedBegin = AlignUp(begin, HUGE_PAGE_SIZE);
+
+	if (alignedBegin > begin)
+		munmap(region, alignedBegin - begin);
+	munmap(reinterpret_cast<void *>(alignedBegin + size), begin + HUGE_PAGE_SIZE - alignedBegin);
+
+	return reinterpret_cast<std::byte *>(alignedBegin);
+#endif
+}
+
+static void BindRegion(std::byte *begin, std::size_t size, std::size_t node)
+{
+#ifndef _WIN32
+	// Preferred rather than strict binding so a full node still falls back to other memory
+	unsigned long nodeMask = 1ul << node;
+	syscall(SYS_mbind, begin, size, MPOL_PREFERRED, &nodeMask, MAX_NUMA_NODES + 1, 0);
+#endif
+}
+
+static bool CommitRegion(std::byte *begin, std::size_t size, HugePageMode hugePages, [[maybe_unused]] std::size_t node)
+{
+#ifdef _WIN32
+	if (node != ANY_NUMA_NODE)
+		return VirtualAllocExNuma(GetCurrentProcess(), begin, size, MEM_COMMIT, PAGE_READWRITE, static_cast<DWORD>(node)) != nullptr;
+
+	return VirtualAlloc(begin, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+	if (mprotect(begin, size, PROT_READ | PROT_WRITE) != 0)
+		return false;
+
+#ifdef MADV_HUGEPAGE
+	if (hugePages == HugePageMode::Advise)
+		madvise(begin, size, MADV_HUGEPAGE);
+#endif
+
+	return true;
+#endif
+}
+
+static void ReleaseRegion(std::byte *begin, std::size_t size)
+{
+#ifdef _WIN32
+	VirtualFree(begin, 0, MEM_RELEASE);
+#else
+	munmap(begin, size);
+#endif
+}
+
+static std::size_t DetectNodeCount()
+{
+#ifdef _WIN32
+	ULONG highestNode = 0;
+	if (!GetNumaHighestNodeNumber(&highestNode))
+		return 1;
+
+	return highestNode + 1;
+#else
+	std::size_t count = 0;
+	while (std::filesystem::exists("/sys/devices/system/node/node" + std::to_string(count)))
+		++count;
+
+	return std::max<std::size_t>(count, 1);
+#endif
+}
+
+MemoryPool::MemoryPool(std::size_t maxBlockCount, const MemoryPoolOptions& options)
+	: m_generation(++m_lastGeneration), m_hugePages(options.HugePages)
+{
+	m_simulatedNodes = options.SimulatedNodeCount > 0;
+	m_nodeCount = std::min(m_simulatedNodes ? options.SimulatedNodeCount : DetectNodeCount(), MAX_NUMA_NODES);
+
+	m_chunkBytes = AlignUp(std::max<std::size_t>(options.CommitChunkBlocks, 1) * BLOCK_SIZE, MAX_BLOCK_SIZE);
+	if (m_hugePages != HugePageMode::None)
+		m_chunkBytes = AlignUp(m_chunkBytes, HUGE_PAGE_SIZE);
+
+	m_reservedBytes = AlignUp(maxBlockCount * BLOCK_SIZE, m_chunkBytes);
+
+	for (std::size_t node = 0; node < m_nodeCount; ++node)
+	{
+		for (std::size_t sizeClass = 0; sizeClass < BLOCK_SIZE_CLASSES; ++sizeClass)
+		{
+			auto& partition = m_partitions[node][sizeClass];
+
+			partition.Region = ReserveRegion(m_reservedBytes, m_hugePages);
+			if (!partition.Region)
+				throw std::bad_alloc();
+
+			if (m_nodeCount > 1 && !m_simulatedNodes)
+				BindRegion(partition.Region, m_reservedBytes, node);
+
+			partition.Blocks.reserve(m_chunkBytes / BLOCK_SIZES[sizeClass]);
+		}
+	}
+}
+
+MemoryPool::~MemoryPool()
+{
+	for (std::size_t node = 0; node < m_nodeCount; ++node)
+	{
+		for (auto& partition : m_partitions[node])
+			ReleaseRegion(partition.Region, m_reservedBytes);
+	}
+}
+
+std::size_t MemoryPool::DetectNode()
+{
+	if (m_simulatedNodes)
+	{
+		// Spread threads round-robin over the simulated nodes, keeping each on the node it was first given
+		static std::atomic_size_t nextNode = 0;
+		thread_local std::size_t simulatedNode = nextNode++;
+
+		return simulatedNode % m_nodeCount;
+	}
+
+	if (m_nodeCount == 1)
+		return 0;
+
+#ifdef _WIN32
+	PROCESSOR_NUMBER processor;
+	USHORT node = 0;
+
+	GetCurrentProcessorNumberEx(&processor);
+	GetNumaProcessorNodeEx(&processor, &node);
+#else
+	unsigned cpu = 0;
+	unsigned node = 0;
+
+	syscall(SYS_getcpu, &cpu, &node, nullptr);
+#endif
+
+	return node % m_nodeCount;
+}
+
+bool MemoryPool::CommitChunk(std::size_t node, std::size_t sizeClass)
+{
+	auto& partition = m_partitions[node][sizeClass];
+	auto blockSize = BLOCK_SIZES[sizeClass];
+
+	if (partition.CommittedBlocks * blockSize == m_reservedBytes)
+		return false;
+
+	auto chunk = partition.Region + partition.CommittedBlocks * blockSize;
+	auto bindNode = m_nodeCount > 1 && !m_simulatedNodes ? node : ANY_NUMA_NODE;
+
+	if (!CommitRegion(chunk, m_chunkBytes, m_hugePages, bindNode))
+		return false;
+
+	auto chunkBlocks = m_chunkBytes / blockSize;
+	partition.CommittedBlocks += chunkBlocks;
+
+	// Push in reverse so the lowest addresses are handed out first
+	for (std::size_t i = chunkBlocks; i > 0; --i)
+		partition.Blocks.push_back(reinterpret_cast<std::size_t *>(chunk + (i - 1) * blockSize));
+
+	return true;
+}
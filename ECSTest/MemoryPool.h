@@ -5,16 +5,71 @@
 #include <atomic>
 #include <shared_mutex>
 #include <optional>
-#include <concurrent_queue.h>
+#include <cstddef>
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <concepts>
+#include <mutex>
+#include <new>
+#include <bit>
 
 
-const size_t BLOCK_SIZE = 4096;
+const size_t BLOCK_SIZE = 4096; // Smallest block size class
+const size_t BLOCK_SIZE_CLASSES = 3;
+constexpr std::array<std::size_t, BLOCK_SIZE_CLASSES> BLOCK_SIZES = { BLOCK_SIZE, 4 * BLOCK_SIZE, 16 * BLOCK_SIZE };
+const size_t MAX_BLOCK_SIZE = BLOCK_SIZES[BLOCK_SIZE_CLASSES - 1];
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const size_t MAGAZINE_SIZE = 64; // 4KB blocks cached per thread before spilling back to the pool, fewer for larger classes
+const size_t MAX_NUMA_NODES = 8;
+const size_t ANY_NUMA_NODE = ~0ull;
 
 template<typename T>
-concept BlockSized = sizeof(T) <= BLOCK_SIZE;
+concept BlockSized = sizeof(T) <= MAX_BLOCK_SIZE;
+
+// Smallest size class that fits the given number of bytes
+constexpr std::size_t GetSizeClass(std::size_t size)
+{
+	std::size_t sizeClass = 0;
+	while (sizeClass < BLOCK_SIZE_CLASSES - 1 && BLOCK_SIZES[sizeClass] < size)
+		++sizeClass;
+
+	return sizeClass;
+}
+
+// Smallest block size that holds at least minCount elements of the given size, or the largest block size
+constexpr std::size_t GetBlockSizeFor(std::size_t elementSize, std::size_t minCount)
+{
+	for (auto blockSize : BLOCK_SIZES)
+	{
+		if (std::bit_floor(blockSize / elementSize) >= minCount)
+			return blockSize;
+	}
+
+	return MAX_BLOCK_SIZE;
+}
+
+enum class HugePageMode
+{
+	None,     // Regular pages
+	Advise,   // Transparent huge pages through madvise(MADV_HUGEPAGE), no-op where unsupported
+	Explicit  // MAP_HUGETLB reservation, falls back to Advise if no huge pages are configured
+};
+
+struct MemoryPoolOptions
+{
+	std::size_t CommitChunkBlocks = HUGE_PAGE_SIZE / BLOCK_SIZE; // In 4KB blocks, rounded up to whole blocks of the largest class
+	HugePageMode HugePages = HugePageMode::None;
+	std::size_t SimulatedNodeCount = 0; // Pretend the machine has this many NUMA nodes, 0 uses the real topology
+};
+
+struct MemoryPoolStats
+{
+	std::size_t LocalBlocks;  // Handed out from the requesting thread's node
+	std::size_t PinnedBlocks; // Handed out from a node requested explicitly
+	std::size_t RemoteBlocks; // Handed out from another node because the preferred one was exhausted
+};
 
 class MemoryPool
 {
@@ -37,7 +92,8 @@ public:
 		auto operator<=>(const Ptr<T>& other);
 
 		T *Load();
-		void WeakSwap(Ptr<T> other);
+		T *Release();
+		void WeakSwap(Ptr<T>& other);
 		void Store(T *ptr);
 		void WaitNonnull();
 		void NotifyNonnull();
@@ -46,60 +102,308 @@ public:
 		void Move(Ptr<T>& other);
 	};
 
-	static void Initialize(std::size_t blockCount);
+	// Reserves address space for maxBlockCount 4KB blocks per NUMA node and size class,
+	// which is committed in chunks as blocks are requested
+	static void Initialize(std::size_t maxBlockCount, const MemoryPoolOptions& options = {});
 	static void Destroy();
 
+	static std::size_t GetCommittedBytes();
+	static std::size_t GetReservedBytes();
+	static MemoryPoolStats GetStats();
+
+	static std::size_t GetNodeCount();
+	static std::size_t GetCurrentNode();
+	static std::size_t GetBlockNode(const void *block);
+
+	// Binds the calling thread to a node, ANY_NUMA_NODE returns it to the node it is running on
+	static void SetThreadNode(std::size_t node);
+
+	// Blocks come from the calling thread's node unless a node is given, sized by the smallest class that fits T
 	template<BlockSized T>
-	static Ptr<T> RequestBlock();
+	static Ptr<T> RequestBlock(std::size_t node = ANY_NUMA_NODE);
 private:
+	template<BlockSized T>
+	static inline constexpr std::size_t SIZE_CLASS = GetSizeClass(sizeof(T));
+
+	// Thread-local cache of free blocks, refilled from and spilled to a node's stack in batches
+	struct Magazine
+	{
+		std::size_t Generation = 0; // Of the pool the blocks came from, 0 if none
+		std::size_t Node = 0;
+		std::size_t SizeClass = 0;
+		std::size_t Capacity = 0;
+		std::size_t Count = 0;
+		std::size_t *Blocks[MAGAZINE_SIZE];
+
+		~Magazine();
+	};
+
+	// Blocks of one size class backed by the memory of a single NUMA node
+	struct Partition
+	{
+		std::byte *Region = nullptr;
+		std::size_t CommittedBlocks = 0;
+		std::vector<std::size_t *> Blocks;
+		std::mutex Lock;
+
+		std::atomic_size_t LocalBlocks = 0;
+		std::atomic_size_t PinnedBlocks = 0;
+		std::atomic_size_t RemoteBlocks = 0;
+	};
+
 	static MemoryPool *m_globalPool;
-	MemoryPool(std::size_t blockCount);
+	static std::size_t m_lastGeneration;
+	static thread_local Magazine m_magazines[MAX_NUMA_NODES][BLOCK_SIZE_CLASSES];
+	static thread_local std::size_t m_threadNode;
+	static thread_local bool m_threadNodeBound;
+
+	MemoryPool(std::size_t maxBlockCount, const MemoryPoolOptions& options);
 	~MemoryPool();
 
-	std::size_t *m_region;
-	std::vector<std::size_t *> m_blocks;
-	std::shared_mutex m_replenishLock;
-	std::atomic_size_t m_blockTop;
+	static Magazine& GetMagazine(std::size_t node, std::size_t sizeClass);
+	static std::size_t RefreshThreadNode();
+	static std::size_t FindBlockNode(const void *block, std::size_t sizeClass);
+	static std::size_t *AcquireBlock(std::size_t node, std::size_t sizeClass);
+	static void ReleaseBlock(void *block, std::size_t sizeClass);
+
+	std::size_t DetectNode();
+	void Refill(Magazine& magazine, bool pinned);
+	void Spill(Magazine& magazine, std::size_t count);
+	bool CommitChunk(std::size_t node, std::size_t sizeClass);
+
+	std::array<std::array<Partition, BLOCK_SIZE_CLASSES>, MAX_NUMA_NODES> m_partitions;
+	std::size_t m_nodeCount;
+	bool m_simulatedNodes;
+
+	std::size_t m_reservedBytes; // Per partition
+	std::size_t m_chunkBytes;
+	std::size_t m_generation; // Unlike the pool's address, never reused by a later pool
+	HugePageMode m_hugePages;
 };
 
-inline void MemoryPool::Initialize(std::size_t blockCount)
+inline void MemoryPool::Initialize(std::size_t maxBlockCount, const MemoryPoolOptions& options)
 {
-	m_globalPool = new MemoryPool(blockCount);
+	m_globalPool = new MemoryPool(maxBlockCount, options);
+	m_threadNode = ANY_NUMA_NODE;
+	m_threadNodeBound = false;
 }
 
 inline void MemoryPool::Destroy()
 {
+	// Magazines of other threads are orphaned and discarded since their generation no longer matches
+	for (auto& nodeMagazines : m_magazines)
+	{
+		for (auto& magazine : nodeMagazines)
+		{
+			magazine.Generation = 0;
+			magazine.Count = 0;
+		}
+	}
+
 	delete m_globalPool;
+	m_globalPool = nullptr;
 }
 
-inline MemoryPool::MemoryPool(std::size_t blockCount)
+inline std::size_t MemoryPool::GetCommittedBytes()
 {
-	m_region = new std::size_t[blockCount * BLOCK_SIZE / sizeof(std::size_t)];
-	m_blocks.resize(blockCount);
-	m_blockTop = blockCount - 1;
+	std::size_t bytes = 0;
+	for (std::size_t node = 0; node < m_globalPool->m_nodeCount; ++node)
+	{
+		for (std::size_t sizeClass = 0; sizeClass < BLOCK_SIZE_CLASSES; ++sizeClass)
+		{
+			auto& partition = m_globalPool->m_partitions[node][sizeClass];
+			std::lock_guard lock(partition.Lock);
+			bytes += partition.CommittedBlocks * BLOCK_SIZES[sizeClass];
+		}
+	}
 
-	auto region = m_region;
-	for (std::size_t i = 0; i < blockCount; ++i)
+	return bytes;
+}
+
+inline std::size_t MemoryPool::GetReservedBytes()
+{
+	return m_globalPool->m_reservedBytes * m_globalPool->m_nodeCount * BLOCK_SIZE_CLASSES;
+}
+
+inline MemoryPoolStats MemoryPool::GetStats()
+{
+	MemoryPoolStats stats = {};
+	for (std::size_t node = 0; node < m_globalPool->m_nodeCount; ++node)
 	{
-		m_blocks[i] = region;
-		region += BLOCK_SIZE / sizeof(std::size_t);
+		for (auto& partition : m_globalPool->m_partitions[node])
+		{
+			stats.LocalBlocks += partition.LocalBlocks.load(std::memory_order_relaxed);
+			stats.PinnedBlocks += partition.PinnedBlocks.load(std::memory_order_relaxed);
+			stats.RemoteBlocks += partition.RemoteBlocks.load(std::memory_order_relaxed);
+		}
 	}
+
+	return stats;
 }
 
-inline MemoryPool::~MemoryPool()
+inline std::size_t MemoryPool::GetNodeCount()
 {
-	m_blocks.clear();
-	delete[] m_region;
+	return m_globalPool->m_nodeCount;
 }
 
-template<BlockSized T>
-inline static MemoryPool::Ptr<T> MemoryPool::RequestBlock()
+inline std::size_t MemoryPool::GetCurrentNode()
 {
-	m_globalPool->m_replenishLock.lock_shared();
-	auto block = m_globalPool->m_blocks[m_globalPool->m_blockTop--];
-	m_globalPool->m_replenishLock.unlock_shared();
+	[[unlikely]]
+	if (m_threadNode >= m_globalPool->m_nodeCount)
+		return RefreshThreadNode();
 
-	return new(block) T;
+	return m_threadNode;
+}
+
+inline std::size_t MemoryPool::GetBlockNode(const void *block)
+{
+	for (std::size_t sizeClass = 0; sizeClass < BLOCK_SIZE_CLASSES; ++sizeClass)
+	{
+		auto node = FindBlockNode(block, sizeClass);
+		if (node != ANY_NUMA_NODE)
+			return node;
+	}
+
+	return ANY_NUMA_NODE;
+}
+
+inline std::size_t MemoryPool::FindBlockNode(const void *block, std::size_t sizeClass)
+{
+	auto address = reinterpret_cast<const std::byte *>(block);
+
+	for (std::size_t node = 0; node < m_globalPool->m_nodeCount; ++node)
+	{
+		auto region = m_globalPool->m_partitions[node][sizeClass].Region;
+		if (address >= region && address < region + m_globalPool->m_reservedBytes)
+			return node;
+	}
+
+	return ANY_NUMA_NODE;
+}
+
+inline void MemoryPool::SetThreadNode(std::size_t node)
+{
+	m_threadNodeBound = node != ANY_NUMA_NODE;
+	m_threadNode = m_threadNodeBound ? node % m_globalPool->m_nodeCount : ANY_NUMA_NODE;
+}
+
+inline MemoryPool::Magazine::~Magazine()
+{
+	// Return cached blocks when the thread exits, unless the pool was destroyed in the meantime
+	if (m_globalPool && Generation == m_globalPool->m_generation && Count > 0)
+		m_globalPool->Spill(*this, Count);
+}
+
+inline MemoryPool::Magazine& MemoryPool::GetMagazine(std::size_t node, std::size_t sizeClass)
+{
+	auto& magazine = m_magazines[node][sizeClass];
+
+	[[unlikely]]
+	if (magazine.Generation != m_globalPool->m_generation)
+	{
+		magazine.Generation = m_globalPool->m_generation;
+		magazine.Node = node;
+		magazine.SizeClass = sizeClass;
+		magazine.Capacity = MAGAZINE_SIZE * BLOCK_SIZE / BLOCK_SIZES[sizeClass];
+		magazine.Count = 0;
+	}
+
+	return magazine;
+}
+
+inline std::size_t MemoryPool::RefreshThreadNode()
+{
+	if (!m_threadNodeBound || m_threadNode >= m_globalPool->m_nodeCount)
+		m_threadNode = m_globalPool->DetectNode();
+
+	return m_threadNode;
+}
+
+inline std::size_t *MemoryPool::AcquireBlock(std::size_t node, std::size_t sizeClass)
+{
+	const bool pinned = node != ANY_NUMA_NODE;
+	auto magazine = &GetMagazine(pinned ? node % m_globalPool->m_nodeCount : GetCurrentNode(), sizeClass);
+
+	[[unlikely]]
+	if (magazine->Count == 0)
+	{
+		// Threads may have migrated since the last refill, so sample the node again
+		if (!pinned)
+			magazine = &GetMagazine(RefreshThreadNode(), sizeClass);
+
+		if (magazine->Count == 0)
+			m_globalPool->Refill(*magazine, pinned);
+	}
+
+	return magazine->Blocks[--magazine->Count];
+}
+
+inline void MemoryPool::ReleaseBlock(void *block, std::size_t sizeClass)
+{
+	// Blocks go back to the node that backs them, regardless of which thread frees them
+	auto& magazine = GetMagazine(FindBlockNode(block, sizeClass), sizeClass);
+
+	[[unlikely]]
+	if (magazine.Count == magazine.Capacity)
+		m_globalPool->Spill(magazine, magazine.Capacity / 2);
+
+	magazine.Blocks[magazine.Count++] = reinterpret_cast<std::size_t *>(block);
+}
+
+inline void MemoryPool::Refill(Magazine& magazine, bool pinned)
+{
+	for (std::size_t i = 0; i < m_nodeCount; ++i)
+	{
+		// Prefer the magazine's node, then fall back to the other nodes in order
+		auto node = (magazine.Node + i) % m_nodeCount;
+		auto& partition = m_partitions[node][magazine.SizeClass];
+
+		std::lock_guard lock(partition.Lock);
+
+		if (partition.Blocks.empty() && !CommitChunk(node, magazine.SizeClass))
+			continue;
+
+		auto count = std::min(magazine.Capacity / 2, partition.Blocks.size());
+		auto first = partition.Blocks.end() - count;
+
+		std::copy(first, partition.Blocks.end(), magazine.Blocks + magazine.Count);
+		partition.Blocks.erase(first, partition.Blocks.end());
+		magazine.Count += count;
+
+		auto& counter = i > 0 ? partition.RemoteBlocks : pinned ? partition.PinnedBlocks : partition.LocalBlocks;
+		counter.fetch_add(count, std::memory_order_relaxed);
+
+		return;
+	}
+
+	throw std::bad_alloc();
+}
+
+inline void MemoryPool::Spill(Magazine& magazine, std::size_t count)
+{
+	magazine.Count -= count;
+
+	auto cur = magazine.Blocks + magazine.Count;
+	auto end = cur + count;
+
+	// Remote fallback refills can leave blocks of other nodes in a magazine, so route each run to its owner
+	while (cur != end)
+	{
+		auto node = FindBlockNode(*cur, magazine.SizeClass);
+		auto runEnd = std::find_if(cur, end, [&](std::size_t *block) { return FindBlockNode(block, magazine.SizeClass) != node; });
+
+		auto& partition = m_partitions[node][magazine.SizeClass];
+		std::lock_guard lock(partition.Lock);
+		partition.Blocks.insert(partition.Blocks.end(), cur, runEnd);
+
+		cur = runEnd;
+	}
+}
+
+template<BlockSized T>
+inline MemoryPool::Ptr<T> MemoryPool::RequestBlock(std::size_t node)
+{
+	return new(AcquireBlock(node, SIZE_CLASS<T>)) T;
 }
 
 template<BlockSized T>
@@ -121,9 +425,7 @@ inline MemoryPool::Ptr<T>::~Ptr()
 	if constexpr (!std::is_trivially_destructible_v<T>)
 		val->~T();
 
-	m_globalPool->m_replenishLock.lock();
-	m_globalPool->m_blocks[++m_globalPool->m_blockTop] = reinterpret_cast<std::size_t *>(m_ptr.load());
-	m_globalPool->m_replenishLock.unlock();
+	ReleaseBlock(val, SIZE_CLASS<T>);
 
 	m_ptr = nullptr;
 }
@@ -190,7 +492,13 @@ inline T *MemoryPool::Ptr<T>::Load()
 }
 
 template<BlockSized T>
-inline void MemoryPool::Ptr<T>::WeakSwap(Ptr<T> other)
+inline T *MemoryPool::Ptr<T>::Release()
+{
+	return m_ptr.exchange(nullptr);
+}
+
+template<BlockSized T>
+inline void MemoryPool::Ptr<T>::WeakSwap(Ptr<T>& other)
 {
 	auto self = m_ptr.exchange(other.m_ptr);
 	other.m_ptr.exchange(self);
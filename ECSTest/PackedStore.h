@@ -0,0 +1,426 @@
+#pragma once
+
+#include "PooledStore.h"
+#include "AtomicBitset.h"
+
+// Components without data, they only mark which archetype an object is in and take no memory per object
+template<typename T>
+concept TagComponent = std::is_empty_v<T>;
+
+// Base for components that are a single flag, stored as one bit per object:
+//
+// struct Frozen : BoolComponent {};
+struct BoolComponent
+{
+	bool Value;
+};
+
+template<typename T>
+concept PackedBoolComponent = std::derived_from<T, BoolComponent> && sizeof(T) == sizeof(BoolComponent);
+
+template<typename T>
+concept ComponentCompatible = StoreCompatible<T> || TagComponent<T> || PackedBoolComponent<T>;
+
+// Same interface as PooledStore, but every object shares one empty instance
+template<TagComponent T>
+class TagStore
+{
+public:
+	static const std::size_t T_PER_BLOCK = BLOCK_SIZE * 8; // Large enough not to shrink chunks of other components
+
+	template<typename TIter>
+	using Reference = TIter&;
+
+	template<typename TIter>
+	class Span
+	{
+	public:
+		Span(std::size_t count) : m_count(count)
+		{
+		}
+
+		TIter& operator[](std::size_t index) const
+		{
+			return m_instance;
+		}
+
+		std::size_t size() const
+		{
+			return m_count;
+		}
+	private:
+		std::size_t m_count;
+	};
+
+	template<typename TIter, WriteMode Mode = WriteMode::Copy> requires std::same_as<T, TIter> || std::same_as<const T, TIter>
+	class Iterator
+	{
+	public:
+		using iterator = Iterator<TIter, Mode>;
+		using reference = TIter&;
+		using pointer = TIter *;
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = TIter;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator(TagStore<T>&, std::size_t index) : m_curIndex(index)
+		{
+		}
+
+		Iterator() : m_curIndex(std::numeric_limits<std::size_t>::max())
+		{
+		}
+
+		iterator& operator++()
+		{
+			++m_curIndex;
+			return *this;
+		}
+
+		iterator& operator+=(difference_type diff)
+		{
+			m_curIndex += diff;
+			return *this;
+		}
+
+		reference operator*() const
+		{
+			return m_instance;
+		}
+
+		Span<TIter> GetSpan(std::size_t count) const
+		{
+			return Span<TIter>(count);
+		}
+
+		auto operator<=>(const iterator& other) const
+		{
+			return m_curIndex <=> other.m_curIndex;
+		}
+
+		auto operator==(const iterator& other) const
+		{
+			return m_curIndex == other.m_curIndex;
+		}
+
+		inline std::size_t GetIndex() const
+		{
+			return m_curIndex;
+		}
+	private:
+		std::size_t m_curIndex;
+	};
+
+	Iterator<T> Emplace(std::size_t firstIndex, std::size_t, std::size_t = 0)
+	{
+		return Iterator<T>(*this, firstIndex);
+	}
+
+	template<typename TIter, WriteMode Mode = WriteMode::Copy>
+	Iterator<TIter, Mode> GetIterator(std::size_t index)
+	{
+		return Iterator<TIter, Mode>(*this, index);
+	}
+
+	void SetPreferredNode(std::size_t)
+	{
+	}
+
+	void SetChangeClock(const ChangeClock *)
+	{
+	}
+
+	// Tags are never written, only added or removed along with the archetype
+	ChangeVersion GetBlockVersion(std::size_t)
+	{
+		return 0;
+	}
+private:
+	inline static T m_instance;
+};
+
+// Same interface as PooledStore for flag components, one bit per object in an AtomicBitset. Bits are written
+// atomically in place in every write mode, so readers see each write on its own instead of a block at a time
+template<PackedBoolComponent T>
+class BitStore
+{
+public:
+	static const std::size_t T_PER_BLOCK = BLOCK_SIZE; // Objects sharing a version stamp, a slice of a bitset block
+
+	// Proxy standing in for T&, converts to and from T or bool
+	template<typename TIter>
+	class Reference
+	{
+	public:
+		static constexpr inline bool IsConst = std::is_const_v<TIter>;
+
+		Reference(BitStore<T>& store, std::size_t index) : m_store(&store), m_index(index)
+		{
+		}
+
+		Reference(const Reference& other) = default;
+
+		// Assignment writes through the proxy like it would through a reference
+		Reference& operator=(const Reference& other) requires (!IsConst)
+		{
+			return *this = static_cast<bool>(other);
+		}
+
+		Reference& operator=(const T& value) requires (!IsConst)
+		{
+			return *this = value.Value;
+		}
+
+		Reference& operator=(bool value) requires (!IsConst)
+		{
+			m_store->Set(m_index, value);
+			return *this;
+		}
+
+		operator T() const
+		{
+			T value{};
+			value.Value = m_store->Get(m_index);
+
+			return value;
+		}
+
+		operator bool() const
+		{
+			return m_store->Get(m_index);
+		}
+	private:
+		BitStore<T> *m_store;
+		std::size_t m_index;
+	};
+
+	// Chunk access to the flags, either one at a time or 64 per word
+	template<typename TIter>
+	class Span
+	{
+	public:
+		Span(BitStore<T>& store, std::size_t first, std::size_t count) : m_store(&store), m_first(first), m_count(count)
+		{
+		}
+
+		Reference<TIter> operator[](std::size_t index) const
+		{
+			return Reference<TIter>(*m_store, m_first + index);
+		}
+
+		// Flags of objects [word * 64, word * 64 + 64) of the span, bits past the end are 0
+		std::uint64_t GetWord(std::size_t word) const
+		{
+			auto index = m_first + word * 64;
+			auto shift = index % 64;
+
+			auto bits = m_store->m_bits.GetWord(index) >> shift;
+			if (shift > 0 && m_count - word * 64 > 64 - shift)
+				bits |= m_store->m_bits.GetWord(index + 64) << (64 - shift);
+
+			auto valid = m_count - word * 64;
+			return valid >= 64 ? bits : bits & ~(~0ull << valid);
+		}
+
+		std::size_t size() const
+		{
+			return m_count;
+		}
+	private:
+		BitStore<T> *m_store;
+		std::size_t m_first;
+		std::size_t m_count;
+	};
+
+	template<typename TIter, WriteMode Mode = WriteMode::Copy> requires std::same_as<T, TIter> || std::same_as<const T, TIter>
+	class Iterator
+	{
+	public:
+		using iterator = Iterator<TIter, Mode>;
+		using reference = Reference<TIter>;
+		using pointer = TIter *;
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = TIter;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator(BitStore<T>& store, std::size_t index) : m_store(&store), m_curIndex(index)
+		{
+		}
+
+		Iterator() : m_store(nullptr), m_curIndex(std::numeric_limits<std::size_t>::max())
+		{
+		}
+
+		iterator& operator++()
+		{
+			++m_curIndex;
+			return *this;
+		}
+
+		iterator& operator+=(difference_type diff)
+		{
+			m_curIndex += diff;
+			return *this;
+		}
+
+		reference operator*() const
+		{
+			return reference(*m_store, m_curIndex);
+		}
+
+		Span<TIter> GetSpan(std::size_t count) const
+		{
+			return Span<TIter>(*m_store, m_curIndex, count);
+		}
+
+		auto operator<=>(const iterator& other) const
+		{
+			return m_curIndex <=> other.m_curIndex;
+		}
+
+		auto operator==(const iterator& other) const
+		{
+			return m_curIndex == other.m_curIndex;
+		}
+
+		inline std::size_t GetIndex() const
+		{
+			return m_curIndex;
+		}
+	private:
+		BitStore<T> *m_store;
+		std::size_t m_curIndex;
+	};
+
+	BitStore();
+	BitStore(const BitStore<T>&) = delete;
+	BitStore& operator=(const BitStore<T>&) = delete;
+
+	Iterator<T> Emplace(std::size_t firstIndex, std::size_t count, std::size_t prefix=0);
+
+	template<typename TIter, WriteMode Mode = WriteMode::Copy>
+	Iterator<TIter, Mode> GetIterator(std::size_t index)
+	{
+		return Iterator<TIter, Mode>(*this, index);
+	}
+
+	bool Get(std::size_t index);
+	void Set(std::size_t index, bool value);
+
+	void SetPreferredNode(std::size_t node);
+	void SetChangeClock(const ChangeClock *clock);
+	ChangeVersion GetBlockVersion(std::size_t index);
+private:
+	static const std::size_t VERSIONS_PER_NODE = BLOCK_SIZE / sizeof(ChangeClock);
+
+	struct VersionNode
+	{
+		ChangeClock Version[VERSIONS_PER_NODE];
+	};
+
+	AtomicBitset m_bits;
+	RadixIndex<VersionNode> m_versions;
+	std::size_t m_node;
+	const ChangeClock *m_changeClock;
+
+	ChangeClock& GetVersion(std::size_t index);
+	ChangeVersion GetCurrentVersion() const;
+};
+
+template<PackedBoolComponent T>
+inline BitStore<T>::BitStore() : m_node(ANY_NUMA_NODE), m_changeClock(nullptr)
+{
+}
+
+template<PackedBoolComponent T>
+inline BitStore<T>::Iterator<T> BitStore<T>::Emplace(std::size_t firstIndex, std::size_t count, std::size_t)
+{
+	if (count == 0)
+		return Iterator<T>(*this, firstIndex);
+
+	m_bits.GrowBitsTo(firstIndex + count);
+
+	auto version = GetCurrentVersion();
+	for (std::size_t block = firstIndex / T_PER_BLOCK; block <= (firstIndex + count - 1) / T_PER_BLOCK; ++block)
+	{
+		auto node = m_versions.FindOrCreate(block / VERSIONS_PER_NODE, m_node);
+		node->Version[block % VERSIONS_PER_NODE] = version;
+	}
+
+	return Iterator<T>(*this, firstIndex);
+}
+
+template<PackedBoolComponent T>
+inline bool BitStore<T>::Get(std::size_t index)
+{
+	return m_bits.Get(index);
+}
+
+template<PackedBoolComponent T>
+inline void BitStore<T>::Set(std::size_t index, bool value)
+{
+	m_bits.Set(index, value);
+	GetVersion(index) = GetCurrentVersion();
+}
+
+template<PackedBoolComponent T>
+inline void BitStore<T>::SetPreferredNode(std::size_t node)
+{
+	m_node = node;
+	m_bits.SetPreferredNode(node);
+}
+
+template<PackedBoolComponent T>
+inline void BitStore<T>::SetChangeClock(const ChangeClock *clock)
+{
+	m_changeClock = clock;
+}
+
+template<PackedBoolComponent T>
+inline ChangeVersion BitStore<T>::GetBlockVersion(std::size_t index)
+{
+	auto block = index / T_PER_BLOCK;
+
+	auto node = m_versions.Find(block / VERSIONS_PER_NODE);
+	if (!node)
+		return 0;
+
+	return node->Version[block % VERSIONS_PER_NODE].load(std::memory_order_relaxed);
+}
+
+template<PackedBoolComponent T>
+inline ChangeClock& BitStore<T>::GetVersion(std::size_t index)
+{
+	auto block = index / T_PER_BLOCK;
+	return m_versions.Find(block / VERSIONS_PER_NODE)->Version[block % VERSIONS_PER_NODE];
+}
+
+template<PackedBoolComponent T>
+inline ChangeVersion BitStore<T>::GetCurrentVersion() const
+{
+	return m_changeClock ? m_changeClock->load(std::memory_order_relaxed) : 1;
+}
+
+template<typename T>
+struct ComponentStoreSelector
+{
+	using Type = PooledStore<T>;
+};
+
+template<TagComponent T>
+struct ComponentStoreSelector<T>
+{
+	using Type = TagStore<T>;
+};
+
+template<PackedBoolComponent T>
+struct ComponentStoreSelector<T>
+{
+	using Type = BitStore<T>;
+};
+
+// Where ParallelPooledStore keeps a component, a PooledStore unless it is a tag or a packed flag
+template<ComponentCompatible T>
+using ComponentStore = ComponentStoreSelector<T>::Type;
@@ -1,36 +1,130 @@
 #pragma once
 
 #include "PooledStore.h"
+#include "PackedStore.h"
 #include "AtomicBitset.h"
 #include "Archetype.h"
 
 #include <tuple>
 #include <ranges>
 #include <atomic>
+#include <functional>
+#include <type_traits>
+#include <span>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <numeric>
+#include <algorithm>
+#include <vector>
+#include <compare>
+
+// Object ids are laid out as [valid:1][archetype:11][generation:12][id:40]. The id part indexes the archetype's id
+// map, the generation is bumped each time compaction recycles the id, so a handle kept past its object's deletion
+// no longer matches the map. Generations wrap after 4096 reuses of the same id
+const size_t ID_BITS = 40;
+const size_t GENERATION_BITS = 12;
+const size_t ARCHETYPE_ID_SHIFT = ID_BITS + GENERATION_BITS;
+
+const auto ID_MASK = ~(~0ull << ID_BITS);
+const auto GENERATION_MASK = ~(~0ull << GENERATION_BITS) << ID_BITS;
+const auto ID_PREFIX_MASK = ~0ull << ARCHETYPE_ID_SHIFT;
+const auto VALID_ID_BIT = 1ull << 63;
+
+const size_t MIN_OBJECTS_PER_TASK = 4096; // Parallel queries split views into tasks of at least this many objects
+
+// Interleaves the bits of grid coordinates, objects close in space get close keys. Sorting a store by it keeps
+// neighbours in the same blocks
+inline std::uint64_t GetMortonKey(std::uint32_t x, std::uint32_t y)
+{
+	auto spread = [](std::uint64_t v)
+	{
+		v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+		v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+		v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		v = (v | (v << 2)) & 0x3333333333333333ull;
+		return (v | (v << 1)) & 0x5555555555555555ull;
+	};
+
+	return spread(x) | spread(y) << 1;
+}
+
+// 21 bits of each coordinate are used
+inline std::uint64_t GetMortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	auto spread = [](std::uint64_t v)
+	{
+		v &= 0x1FFFFF;
+		v = (v | (v << 32)) & 0x001F00000000FFFFull;
+		v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+		v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+		v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+		return (v | (v << 2)) & 0x1249249249249249ull;
+	};
 
-const auto ID_MASK = ~(~0ull << 24);
-const auto MAX_ENTRIES = PooledStore<std::size_t>::MAX_T_PER_STORE;
+	return spread(x) | spread(y) << 1 | spread(z) << 2;
+}
+
+// Position of the id's archetype in its storage
+inline std::size_t GetArchetypeIndex(std::size_t id)
+{
+	return (id & ~VALID_ID_BIT) >> ARCHETYPE_ID_SHIFT;
+}
+
+inline std::size_t GetNextGeneration(std::size_t id)
+{
+	return (id & ~GENERATION_MASK) | ((id + (1ull << ID_BITS)) & GENERATION_MASK);
+}
+
+// Restricts an iterator to objects in recently written blocks, see ParallelPooledStore::GetChangedView
+struct ChangeFilter
+{
+	std::function<std::size_t(std::size_t, std::size_t)> FindChanged; // First index in [index, end) in a changed block, or end
+	std::size_t Granularity; // FindChanged only has to be asked again after crossing a multiple of this
+	std::size_t End;
+};
 
-template<StoreCompatible... Ts>
+// Limits a single compaction slice, whichever runs out first ends it. Holes left over are still skipped by
+// iteration and are filled by a later slice
+struct CompactionBudget
+{
+	std::size_t MaxMoves = std::numeric_limits<std::size_t>::max();
+	std::chrono::microseconds MaxTime = std::chrono::milliseconds(1);
+};
+
+struct FragmentationStats
+{
+	std::size_t SlotCount; // Live and deleted objects that are yet to be compacted
+	std::size_t DeletedCount;
+	double Fragmentation; // DeletedCount / SlotCount
+
+	std::size_t MovedCount; // Objects moved into holes since the store was created
+	std::size_t SliceCount;
+	std::size_t SkippedCount; // Compactions that didn't run because views were open
+	std::chrono::microseconds MaxSliceTime;
+};
+
+template<WriteMode Mode, ComponentCompatible... Ts>
 class ParallelPooledStoreIterator
 {
 public:
 	template<typename T>
-	using StoreIterator = PooledStore<std::remove_const_t<T>>::template Iterator<T>;
+	using StoreIterator = ComponentStore<std::remove_const_t<T>>::template Iterator<T, Mode>;
 
-	using iterator = ParallelPooledStoreIterator<Ts...>;
-	using reference = std::tuple<Ts&...>;
+	using iterator = ParallelPooledStoreIterator<Mode, Ts...>;
+	using reference = std::tuple<typename StoreIterator<Ts>::reference...>; // SoA components come back as proxies
 	using pointer = std::tuple<Ts *...>;
 
 	using iterator_category = std::forward_iterator_tag;
-	using value_type = std::tuple<Ts&...>;
+	using value_type = reference;
 	using difference_type = std::ptrdiff_t;
 
 	using UnconstReference = std::tuple<std::remove_const_t<Ts>&...>;
 
-	ParallelPooledStoreIterator(std::size_t index, AtomicBitset<MAX_ENTRIES>& deletedBits, PooledStore<std::remove_const_t<Ts>>&... stores) 
+	ParallelPooledStoreIterator(std::size_t index, AtomicBitset& deletedBits, ComponentStore<std::remove_const_t<Ts>>&... stores) 
 		: 
-		m_curIndex(index), m_curs(stores.GetIterator<Ts>(index)...), 
+		m_curIndex(index), m_curs(stores.template GetIterator<Ts, Mode>(index)...), 
 		m_deletedCur(deletedBits.ReadonlyBegin()), m_deletedEnd(deletedBits.ReadonlyEnd())
 	{
 		*this += 0; // trigger deletion check
@@ -70,22 +164,34 @@ public:
 	iterator& operator+=(difference_type diff)
 	{
 		// Backward iteration will not include deleted bits checks
-		while (diff > 0 && m_deletedCur != m_deletedEnd && *m_deletedCur == (m_curIndex + diff))
+		if (diff >= 0 && m_deletedCur != m_deletedEnd)
 		{
-			diff += 1;
-			++m_deletedCur;
+			m_deletedCur.SkipTo(m_curIndex + diff);
+
+			while (m_deletedCur != m_deletedEnd && *m_deletedCur == (m_curIndex + diff))
+			{
+				diff += 1;
+				++m_deletedCur;
+			}
 		}
 
-		m_curIndex += diff;
+		[[unlikely]]
+		if (diff > 0 && m_changeFilter.FindChanged && m_curIndex + diff >= m_nextChangeCheck)
+			diff = SkipUnchanged(m_curIndex + diff) - m_curIndex;
 
-		std::apply([&](StoreIterator<Ts>&... elem)
-		{
-			((elem += diff), ...);
-		}, m_curs);
+		Advance(diff);
 
 		return *this;
 	}
 
+	void SetChangeFilter(ChangeFilter filter)
+	{
+		m_changeFilter = std::move(filter);
+		m_nextChangeCheck = 0;
+
+		Advance(SkipUnchanged(m_curIndex) - m_curIndex);
+	}
+
 	/*
 	iterator operator--(int)
 	{
@@ -119,7 +225,7 @@ public:
 	{
 		return std::apply([](StoreIterator<Ts>&... elem)
 		{
-			return std::forward_as_tuple(*elem...);
+			return reference(*elem...);
 		}, m_curs);
 	}
 
@@ -127,7 +233,7 @@ public:
 	{
 		return std::apply([](const StoreIterator<Ts>&... elem)
 		{
-			return std::forward_as_tuple(*elem...);
+			return reference(*elem...);
 		}, m_curs);
 	}
 
@@ -155,18 +261,236 @@ public:
 		return m_curIndex;
 	}
 private:
-	AtomicBitset<MAX_ENTRIES>::OnesIterator<false> m_deletedCur;
-	AtomicBitset<MAX_ENTRIES>::OnesIterator<false> m_deletedEnd;
+	AtomicBitset::OnesIterator<false> m_deletedCur;
+	AtomicBitset::OnesIterator<false> m_deletedEnd;
 	std::tuple<StoreIterator<Ts>...> m_curs;
 	std::size_t m_curIndex;
+
+	ChangeFilter m_changeFilter;
+	std::size_t m_nextChangeCheck;
+
+	void Advance(difference_type diff)
+	{
+		m_curIndex += diff;
+
+		std::apply([&](StoreIterator<Ts>&... elem)
+		{
+			((elem += diff), ...);
+		}, m_curs);
+	}
+
+	std::size_t SkipUnchanged(std::size_t index)
+	{
+		while (true)
+		{
+			auto changed = m_changeFilter.FindChanged(index, m_changeFilter.End);
+			if (changed >= m_changeFilter.End)
+				return m_changeFilter.End;
+
+			m_nextChangeCheck = (changed / m_changeFilter.Granularity + 1) * m_changeFilter.Granularity;
+
+			if (changed == index)
+				return index;
+
+			// Jumped over unchanged blocks, so catch the deleted bits up and step over deleted objects at the landing spot
+			m_deletedCur.SkipTo(changed);
+
+			while (m_deletedCur != m_deletedEnd && *m_deletedCur == changed)
+			{
+				++changed;
+				++m_deletedCur;
+			}
+
+			if (changed < m_nextChangeCheck)
+				return changed;
+
+			index = changed;
+		}
+	}
+};
+
+// Contiguous slice of a view in which every component lives in a single block, so each one is a plain array
+template<typename... Ts>
+struct StoreChunk
+{
+	std::size_t FirstIndex;
+	std::size_t Count;
+	std::tuple<typename ComponentStore<std::remove_const_t<Ts>>::template Span<Ts>...> Spans; // SoA components give per-field arrays
+
+	// Deleted objects keep their slots until the next cleanup, kernels either branch on this or mask with GetLiveMask
+	bool AllLive;
+
+	StoreChunk(
+		std::size_t firstIndex, std::size_t count, std::tuple<typename ComponentStore<std::remove_const_t<Ts>>::template Span<Ts>...> spans, 
+		AtomicBitset& deletedBits
+	)
+		: FirstIndex(firstIndex), Count(count), Spans(spans), m_deletedBits(&deletedBits)
+	{
+		AllLive = deletedBits.FindNextOne(FirstIndex) >= FirstIndex + Count;
+	}
+
+	bool IsLive(std::size_t offset) const
+	{
+		return !m_deletedBits->Get(FirstIndex + offset);
+	}
+
+	// Live bits of objects [word * 64, word * 64 + 64) relative to FirstIndex, bits past Count are 0
+	std::uint64_t GetLiveMask(std::size_t word) const
+	{
+		auto index = FirstIndex + word * 64;
+		auto shift = index % 64;
+
+		auto deleted = m_deletedBits->GetWord(index) >> shift;
+		if (shift > 0 && Count - word * 64 > 64 - shift)
+			deleted |= m_deletedBits->GetWord(index + 64) << (64 - shift);
+
+		return ~deleted & GetValidMask(word);
+	}
+private:
+	AtomicBitset *m_deletedBits;
+
+	std::uint64_t GetValidMask(std::size_t word) const
+	{
+		auto valid = Count - word * 64;
+		return valid >= 64 ? ~0ull : ~(~0ull << valid);
+	}
 };
 
-template<StoreCompatible... Ts>
+// Walks a view one StoreChunk at a time instead of one object at a time, which leaves the inner loop to the
+// caller where it can be vectorized. Chunks are as large as the smallest block of the iterated components
+template<WriteMode Mode, ComponentCompatible... Ts>
+class ParallelPooledStoreChunkIterator
+{
+public:
+	template<typename T>
+	using StoreIterator = ComponentStore<std::remove_const_t<T>>::template Iterator<T, Mode>;
+
+	using iterator = ParallelPooledStoreChunkIterator<Mode, Ts...>;
+	using reference = StoreChunk<Ts...>;
+	using pointer = StoreChunk<Ts...> *;
+
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = StoreChunk<Ts...>;
+	using difference_type = std::ptrdiff_t;
+
+	static constexpr std::size_t CHUNK_SIZE = std::min({ ComponentStore<std::remove_const_t<Ts>>::T_PER_BLOCK... });
+
+	ParallelPooledStoreChunkIterator(
+		std::size_t index, std::size_t endIndex, AtomicBitset& deletedBits, ComponentStore<std::remove_const_t<Ts>>&... stores
+	) 
+		: m_curIndex(index), m_endIndex(endIndex), m_deletedBits(&deletedBits), m_curs(stores.template GetIterator<Ts, Mode>(index)...)
+	{
+	}
+
+	ParallelPooledStoreChunkIterator()
+	{
+	}
+
+	iterator operator++(int)
+	{
+		iterator old = *this;
+		++(*this);
+		return old;
+	}
+
+	iterator& operator++()
+	{
+		auto nextIndex = GetChunkEnd();
+
+		[[unlikely]]
+		if (m_changeFilter.FindChanged && nextIndex < m_endIndex)
+		{
+			auto changed = m_changeFilter.FindChanged(nextIndex, m_endIndex);
+			nextIndex = changed >= m_endIndex ? m_endIndex : changed / CHUNK_SIZE * CHUNK_SIZE;
+		}
+
+		std::apply([&](StoreIterator<Ts>&... elem)
+		{
+			((elem += nextIndex - m_curIndex), ...);
+		}, m_curs);
+
+		m_curIndex = nextIndex;
+
+		return *this;
+	}
+
+	reference operator*() const
+	{
+		auto count = GetChunkEnd() - m_curIndex;
+
+		return std::apply([&](const StoreIterator<Ts>&... elem)
+		{
+			return StoreChunk<Ts...>(m_curIndex, count, std::make_tuple(elem.GetSpan(count)...), *m_deletedBits);
+		}, m_curs);
+	}
+
+	auto operator<=>(const iterator& other) const
+	{
+		return m_curIndex <=> other.m_curIndex;
+	}
+
+	auto operator==(const iterator& other) const
+	{
+		return m_curIndex == other.m_curIndex;
+	}
+
+	void SetChangeFilter(ChangeFilter filter)
+	{
+		m_changeFilter = std::move(filter);
+
+		auto changed = m_changeFilter.FindChanged(m_curIndex, m_endIndex);
+		auto firstIndex = changed >= m_endIndex ? m_endIndex : std::max(changed / CHUNK_SIZE * CHUNK_SIZE, m_curIndex);
+
+		std::apply([&](StoreIterator<Ts>&... elem)
+		{
+			((elem += firstIndex - m_curIndex), ...);
+		}, m_curs);
+
+		m_curIndex = firstIndex;
+	}
+private:
+	std::tuple<StoreIterator<Ts>...> m_curs;
+	std::size_t m_curIndex;
+	std::size_t m_endIndex;
+
+	AtomicBitset *m_deletedBits;
+	ChangeFilter m_changeFilter;
+
+	std::size_t GetChunkEnd() const
+	{
+		return std::min((m_curIndex / CHUNK_SIZE + 1) * CHUNK_SIZE, m_endIndex);
+	}
+};
+
+template<typename TView>
+class StoreChunkRange : public std::ranges::view_interface<StoreChunkRange<TView>>
+{
+public:
+	StoreChunkRange(const TView& view) : m_view(view)
+	{
+	}
+
+	auto begin()
+	{
+		return m_view.ChunksBegin();
+	}
+
+	auto end()
+	{
+		return m_view.ChunksEnd();
+	}
+private:
+	TView m_view; // Holds a reference on the store like any other view
+};
+
+template<ComponentCompatible... Ts>
 class ParallelPooledStore
 {
 public:
 	using ArchType = Archetype<std::size_t, Ts...>;
 
+	static_assert(std::ranges::adjacent_find(ArchType::TYPE_IDS) == ArchType::TYPE_IDS.end(), "Duplicate components or colliding type ids!");
+
 	ParallelPooledStore() : m_curCount(0), m_prefix(0)
 	{
 	}
@@ -176,11 +500,33 @@ public:
 
 	void SetIdPrefix(std::size_t prefix)
 	{
-		m_prefix = prefix << 24 | (1ull << 63); // 40 bit prefix
+		m_prefix = prefix << ARCHETYPE_ID_SHIFT | VALID_ID_BIT; // 11 bit archetype id
+	}
+
+	// Bits every id of the store has under ID_PREFIX_MASK
+	std::size_t GetIdPrefix() const
+	{
+		return m_prefix;
+	}
+
+	void SetPreferredNode(std::size_t node)
+	{
+		m_idMap.SetPreferredNode(node);
+		std::apply([node](auto&... store) { (store.SetPreferredNode(node), ...); }, m_stores);
+	}
+
+	void SetChangeClock(const ChangeClock *clock)
+	{
+		std::apply([clock](auto&... store) { (store.SetChangeClock(clock), ...); }, m_stores);
 	}
 
+	// The view has the components in the given order, the store's own order if none are given
+	template<typename... TQueries>
 	auto Emplace(std::size_t count)
 	{
+		// Holds off compaction while the new slots are written, until the returned view has its own reference
+		View<true, WriteMode::Copy, const std::size_t> pin(*this, 0, 0);
+
 		const auto index = m_curCount.fetch_add(count);
 		const auto newCount = index + count;
 		const auto loadedIdMapSize = m_idMapSize.load();
@@ -194,7 +540,7 @@ public:
 
 		m_deletedBits.GrowBitsTo(newCount);
 
-		std::apply([&](PooledStore<std::size_t>& idStore, PooledStore<Ts>&... elem)
+		std::apply([&](PooledStore<std::size_t>& idStore, ComponentStore<Ts>&... elem)
 		{
 			idStore.Emplace(index, count, m_prefix);
 			((elem.Emplace(index, count)), ...);
@@ -203,42 +549,247 @@ public:
 			auto end = idStore.GetConst(index + count);
 
 			for (; cur < end; ++cur)
-			{
-				const auto curId = *cur & ID_MASK;
-				auto& idMapEntry = *m_idMap.GetConst(curId);
-				const_cast<std::atomic_size_t&>(idMapEntry).store(cur.GetIndex());
-			}
+				SetIdMapEntry(*cur, cur.GetIndex());
 		}, m_stores);
 
-		return View<true, const std::size_t, Ts...>(*this, index, index + count);
+		if constexpr (sizeof...(TQueries) == 0)
+			return View<true, WriteMode::Copy, const std::size_t, Ts...>(*this, index, index + count);
+		else
+			return View<true, WriteMode::Copy, const std::size_t, TQueries...>(*this, index, index + count);
 	}
 
-	void Delete(std::size_t id)
+	// False if the id is stale or the object is already deleted
+	bool Delete(std::size_t id)
 	{
-		id &= ID_MASK;
+		// Compaction can't move another object into the slot between finding and marking it
+		std::shared_lock lock(m_viewCreationLock);
+
+		auto index = FindIndex(id);
+		if (index == NO_INDEX)
+			return false;
 
-		auto index = m_idMap.GetConst(id)->load();
 		m_deletedBits.Set(index, true);
+		return true;
+	}
+
+	// Fills holes left by deleted objects with objects from the tail, for at most one budget's worth of work. Only
+	// runs while no views are open and keeps new views from opening until the slice ends, so readers never see an
+	// object halfway moved. Returns true once no holes are left, false if some remain or views were open
+	bool Compact(const CompactionBudget& budget = {})
+	{
+		if (m_deletedBits.GetOneCount() == 0)
+			return true;
+
+		std::unique_lock lock(m_viewCreationLock, std::try_to_lock);
+		if (!lock.owns_lock() || m_refCount.load() > 0)
+		{
+			++m_skippedCount;
+			return false;
+		}
+
+		return CompactSlice(budget);
+	}
+
+	// Budget of the slice run whenever the last open view of the store is released
+	void SetCompactionBudget(const CompactionBudget& budget)
+	{
+		m_compactionBudget = budget;
+	}
+
+	// Reorders objects by ascending keyFn(TComponent), deleted ones last, a few blocks of work per call. A pass
+	// snapshots the keys, merge sorts them in block sized runs and then swaps objects into place, all columns and the
+	// id map together. Call it with the same key until it returns true, which happens once a pass has put the store
+	// in order. Runs under the same conditions as Compact, and a pass restarts if compaction moves objects
+	template<ComponentCompatible TComponent, typename TKeyFunc>
+		requires std::convertible_to<std::invoke_result_t<TKeyFunc&, const TComponent&>, std::uint64_t>
+	bool SortBy(TKeyFunc keyFn, std::size_t blockCount = 1)
+	{
+		std::unique_lock lock(m_viewCreationLock, std::try_to_lock);
+		if (!lock.owns_lock() || m_refCount.load() > 0)
+			return false;
+
+		if (m_sortCount > 0 && (m_movedCount.load() != m_sortMovedCount || m_curCount.load() < m_sortCount))
+			ResetSort();
+
+		if (m_sortCount == 0)
+		{
+			m_sortCount = m_curCount.load();
+			m_sortMovedCount = m_movedCount.load();
+			m_sortWidth = SORT_BLOCK_SIZE;
+
+			if (m_sortCount == 0)
+				return true;
+		}
+
+		// Objects created since the pass started are left where they are until the next one
+		auto budget = std::max<std::size_t>(blockCount, 1) * SORT_BLOCK_SIZE;
+
+		if (m_sortEntries.size() < m_sortCount)
+			budget = GatherSortRuns<TComponent>(keyFn, budget);
+
+		if (budget > 0 && m_sortWidth < m_sortCount)
+			budget = MergeSortRuns(budget);
+
+		if (budget > 0 && m_sortWidth >= m_sortCount && ApplySortOrder(budget))
+		{
+			ResetSort();
+			return true;
+		}
+
+		return false;
+	}
+
+	FragmentationStats GetFragmentationStats()
+	{
+		FragmentationStats stats;
+
+		stats.SlotCount = m_curCount.load();
+		stats.DeletedCount = m_deletedBits.GetOneCount();
+		stats.Fragmentation = stats.SlotCount > 0 ? static_cast<double>(stats.DeletedCount) / stats.SlotCount : 0.0;
+
+		stats.MovedCount = m_movedCount.load();
+		stats.SliceCount = m_sliceCount.load();
+		stats.SkippedCount = m_skippedCount.load();
+		stats.MaxSliceTime = std::chrono::microseconds(m_maxSliceMicroseconds.load());
+
+		return stats;
+	}
+
+	// Deleted bits are gathered per word and set with one atomic op each, ids in creation order share most words
+	template<std::ranges::input_range TRange> requires std::convertible_to<std::ranges::range_value_t<TRange>, std::size_t>
+	void DeleteMany(TRange&& ids)
+	{
+		std::shared_lock lock(m_viewCreationLock);
+		WordBatch batch(m_deletedBits);
+
+		for (std::size_t id : ids)
+		{
+			auto index = FindIndex(id);
+			if (index != NO_INDEX)
+				batch.Add(index);
+		}
+	}
+
+	static const std::size_t NO_INDEX = std::numeric_limits<std::size_t>::max();
+
+	// Index of a live object, NO_INDEX if the id is stale, deleted or from another archetype. Staleness is a single
+	// compare of the id's generation against the one stored next to the index in the id map
+	std::size_t FindIndex(std::size_t id)
+	{
+		if ((id & ID_PREFIX_MASK) != m_prefix || (id & ID_MASK) >= m_idMapSize.load())
+			return NO_INDEX;
+
+		auto entry = m_idMap.GetConst(id & ID_MASK)->load();
+		if ((entry ^ id) & GENERATION_MASK)
+			return NO_INDEX;
+
+		auto index = entry & ID_MASK;
+		if (index >= m_curCount.load() || m_deletedBits.Get(index))
+			return NO_INDEX;
+
+		return index;
+	}
+
+	// Moves the objects with the given ids from another store into new objects of this one, at a sync point with no
+	// views open on either. Each column is copied in one pass over the moved objects, in source index order.
+	// Components only this store has are set from added or value-initialized, ones only the source has are dropped.
+	// newIds gets each object's new id, 0 for stale ones. Returns a view of the new objects
+	template<ComponentCompatible... TSourceTs, typename... TAdded>
+	auto MoveFrom(
+		ParallelPooledStore<TSourceTs...>& source, std::span<const std::size_t> ids, std::span<std::size_t> newIds,
+		const TAdded&... added
+	)
+	{
+		// Holds off compaction of the source until the moved objects are marked deleted, this store's is held off by
+		// the view Emplace returns
+		typename ParallelPooledStore<TSourceTs...>::template View<true, WriteMode::Copy, const std::size_t> sourcePin(source, 0, 0);
+
+		// Source index and position in ids
+		std::vector<std::pair<std::size_t, std::size_t>> moves;
+		moves.reserve(ids.size());
+
+		for (std::size_t i = 0; i < ids.size(); ++i)
+		{
+			newIds[i] = 0;
+
+			auto index = source.FindIndex(ids[i]);
+			if (index != NO_INDEX)
+				moves.emplace_back(index, i);
+		}
+
+		std::ranges::sort(moves);
+
+		// An id passed twice moves once
+		std::vector<std::size_t> sourceIndices;
+		sourceIndices.reserve(moves.size());
+
+		for (auto [index, position] : moves)
+		{
+			if (sourceIndices.empty() || sourceIndices.back() != index)
+				sourceIndices.push_back(index);
+		}
+
+		if (sourceIndices.empty())
+		{
+			auto count = m_curCount.load();
+			return View<true, WriteMode::Copy, const std::size_t, Ts...>(*this, count, count);
+		}
+
+		auto view = Emplace(sourceIndices.size());
+		auto first = view.GetBeginIndex();
+
+		(MoveColumn<Ts>(source, sourceIndices, first, added...), ...);
+
+		auto idIter = std::get<PooledStore<std::size_t>>(m_stores).template GetIterator<const std::size_t>(first);
+		std::size_t previous = NO_INDEX;
+
+		for (auto [index, position] : moves)
+		{
+			if (index != previous)
+			{
+				if (previous != NO_INDEX)
+					++idIter;
+
+				previous = index;
+			}
+
+			newIds[position] = *idIter;
+		}
+
+		{
+			WordBatch batch(source.m_deletedBits);
+
+			for (auto index : sourceIndices)
+				batch.Add(index);
+		}
+
+		return view;
 	}
 
-	template<bool RefCounted, typename... TQueries>
-	class View : public std::ranges::view_interface<View<RefCounted, TQueries...>>
+	template<bool RefCounted, WriteMode Mode, typename... TQueries>
+	class View : public std::ranges::view_interface<View<RefCounted, Mode, TQueries...>>
 	{
 	public:
-		using Iterator = ParallelPooledStoreIterator<TQueries...>;
+		using Iterator = ParallelPooledStoreIterator<Mode, TQueries...>;
 
 		View(ParallelPooledStore<Ts...>& store, std::size_t beginIndex, std::size_t endIndex) 
 			: m_store(store), m_beginIndex(beginIndex), m_endIndex(endIndex)
 		{
 			IncrementRefcount();
+
+			// Compaction may have shrunk the store between reading its count and taking the reference
+			m_endIndex = std::min(m_endIndex, m_store.m_curCount.load());
+			m_beginIndex = std::min(m_beginIndex, m_endIndex);
 		}
 
-		View(const View& copied) : m_store(copied.m_store), m_beginIndex(copied.m_beginIndex), m_endIndex(copied.m_endIndex)
+		View(const View& copied) 
+			: m_store(copied.m_store), m_beginIndex(copied.m_beginIndex), m_endIndex(copied.m_endIndex), m_changeFilter(copied.m_changeFilter)
 		{
 			IncrementRefcount();
 		}
 
-		View(View&& moved) : m_store(moved.m_store), m_beginIndex(moved.m_beginIndex), m_endIndex(moved.m_endIndex)
+		View(View&& moved) 
+			: m_store(moved.m_store), m_beginIndex(moved.m_beginIndex), m_endIndex(moved.m_endIndex), m_changeFilter(std::move(moved.m_changeFilter))
 		{
 			IncrementRefcount();
 		}
@@ -263,22 +814,20 @@ public:
 		{
 			if constexpr (RefCounted)
 			{
-				auto newRefCount = --m_store.m_refCount;
-				if (newRefCount == 0)
-				{
-					m_store.m_viewCreationLock.lock();
-					while ((newRefCount = m_store.m_refCount) > 0)
-						m_store.m_refCount.wait(newRefCount);
-
-					m_store.ExclusiveCleanup();
-					m_store.m_viewCreationLock.unlock();
-				}
+				if (--m_store.m_refCount == 0)
+					m_store.Compact(m_store.m_compactionBudget);
 			}
 		}
 
 		auto begin()
 		{
-			return CreateIterator(m_beginIndex);
+			auto iter = CreateIterator(m_beginIndex);
+
+			[[unlikely]]
+			if (m_changeFilter.FindChanged)
+				iter.SetChangeFilter(m_changeFilter);
+
+			return iter;
 		}
 
 		auto end()
@@ -291,16 +840,126 @@ public:
 			// Account for overflow (limit the size of a store to 56-bit max)
 			return (m_beginIndex + 0xFF) < (m_endIndex + 0xFF);
 		}
+
+		void SetChangeFilter(ChangeFilter filter)
+		{
+			m_changeFilter = std::move(filter);
+		}
+
+		StoreChunkRange<View> Chunks()
+		{
+			return StoreChunkRange<View>(*this);
+		}
+
+		auto ChunksBegin()
+		{
+			auto iter = CreateChunkIterator(m_beginIndex);
+
+			[[unlikely]]
+			if (m_changeFilter.FindChanged)
+				iter.SetChangeFilter(m_changeFilter);
+
+			return iter;
+		}
+
+		auto ChunksEnd()
+		{
+			return CreateChunkIterator(m_endIndex);
+		}
+
+		// Starts at an object of the view without its change filter or deleted object checks, for walking a sorted
+		// subset of its live objects such as the rows of a join
+		Iterator GetIterator(std::size_t index)
+		{
+			return Iterator(index, std::get<ComponentStore<std::remove_const_t<TQueries>>>(m_store.m_stores).template GetIterator<TQueries, Mode>(index)...);
+		}
+
+		std::size_t GetBeginIndex() const
+		{
+			return m_beginIndex;
+		}
+
+		std::size_t GetEndIndex() const
+		{
+			return m_endIndex;
+		}
+
+		const ChangeFilter& GetChangeFilter() const
+		{
+			return m_changeFilter;
+		}
+
+		// Parallel queries run a view as tasks of TASK_SIZE objects, aligned to the blocks of every written component
+		// so no two tasks copy or lock the same block
+		static constexpr std::size_t GetTaskSize()
+		{
+			return TASK_SIZE;
+		}
+
+		std::size_t GetTaskCount() const
+		{
+			if (m_beginIndex >= m_endIndex)
+				return 0;
+
+			return (m_endIndex + TASK_SIZE - 1) / TASK_SIZE - m_beginIndex / TASK_SIZE;
+		}
+
+		// Covers the objects of the task, it relies on this view to keep compaction out
+		View<false, Mode, TQueries...> GetTaskView(std::size_t task) const
+		{
+			auto taskBegin = (m_beginIndex / TASK_SIZE + task) * TASK_SIZE;
+			auto taskEnd = std::min(taskBegin + TASK_SIZE, m_endIndex);
+
+			View<false, Mode, TQueries...> taskView(m_store, std::max(taskBegin, m_beginIndex), taskEnd);
+
+			// Skipping unchanged blocks must stop at the task's end, not run into the blocks of the next task
+			if (m_changeFilter.FindChanged)
+				taskView.SetChangeFilter({ m_changeFilter.FindChanged, m_changeFilter.Granularity, std::min(taskEnd, m_changeFilter.End) });
+
+			return taskView;
+		}
 	private:
+		template<typename TQuery>
+		static constexpr std::size_t GetWrittenBlockSize()
+		{
+			using TComponent = std::remove_const_t<TQuery>;
+
+			// Flags are written atomically and tags not at all, neither needs its blocks to itself
+			if constexpr (std::is_const_v<TQuery> || TagComponent<TComponent> || PackedBoolComponent<TComponent>)
+				return 1;
+			else
+				return ComponentStore<TComponent>::T_PER_BLOCK;
+		}
+
+		static constexpr std::size_t GetTaskAlignment()
+		{
+			std::size_t alignment = 1;
+			((alignment = std::lcm(alignment, GetWrittenBlockSize<TQueries>())), ...);
+
+			return alignment;
+		}
+
+		static constexpr std::size_t TASK_SIZE = (MIN_OBJECTS_PER_TASK + GetTaskAlignment() - 1) / GetTaskAlignment() * GetTaskAlignment();
+
 		ParallelPooledStore<Ts...>& m_store;
 		std::size_t m_beginIndex;
 		std::size_t m_endIndex;
+		ChangeFilter m_changeFilter;
 
-		ParallelPooledStoreIterator<TQueries...> CreateIterator(std::size_t index)
+		Iterator CreateIterator(std::size_t index)
 		{
 			// Convoluted to fix ambiguous syntax errors
-			return std::make_from_tuple<ParallelPooledStoreIterator<TQueries...>>(
-				std::forward_as_tuple(index, m_store.m_deletedBits, std::get<PooledStore<std::remove_const_t<TQueries>>>(m_store.m_stores)...)
+			return std::make_from_tuple<Iterator>(
+				std::forward_as_tuple(index, m_store.m_deletedBits, std::get<ComponentStore<std::remove_const_t<TQueries>>>(m_store.m_stores)...)
+			);
+		}
+
+		ParallelPooledStoreChunkIterator<Mode, TQueries...> CreateChunkIterator(std::size_t index)
+		{
+			return std::make_from_tuple<ParallelPooledStoreChunkIterator<Mode, TQueries...>>(
+				std::forward_as_tuple(
+					index, m_endIndex, m_store.m_deletedBits, std::get<ComponentStore<std::remove_const_t<TQueries>>>(m_store.m_stores)...
+				)
 			);
 		}
 
@@ -315,93 +974,455 @@ public:
 		}
 	};
 
-	template<typename... TQueries>
-	View<true, TQueries...> GetView()
+	// WriteMode::InPlace views lock and write blocks directly, valid only while no other view reads the written components
+	template<WriteMode Mode, typename... TQueries>
+	View<true, Mode, TQueries...> GetView()
+	{
+		return View<true, Mode, TQueries...>(*this, 0, m_curCount.load());
+	}
+
+	// Only visits objects whose TChangedArch component blocks were written at or after since. Blocks are checked
+	// at the granularity of the smallest of those blocks, so unchanged neighbours of a changed object are visited too
+	template<WriteMode Mode, typename TChangedArch, typename... TQueries>
+	View<true, Mode, TQueries...> GetChangedView(ChangeVersion since)
 	{
-		return View<true, TQueries...>(*this, 0, m_curCount.load());
+		auto endIndex = m_curCount.load();
+
+		View<true, Mode, TQueries...> view(*this, 0, endIndex);
+		view.SetChangeFilter(CreateChangeFilter(std::type_identity<TChangedArch>(), since, endIndex));
+
+		return view;
 	}
 
+	// Empty if the id is stale, deleted or from another archetype
 	template<typename... TQueries>
-	View<true, TQueries...> GetViewAt(std::size_t id)
+	View<true, WriteMode::Copy, TQueries...> GetViewAt(std::size_t id)
 	{
-		id &= ID_MASK;
+		// Holds off compaction until the returned view has its own reference, so the index can't move in between
+		View<true, WriteMode::Copy, TQueries...> empty(*this, 0, 0);
+
+		auto index = FindIndex(id);
+		if (index == NO_INDEX)
+			return empty;
 
-		auto index = *m_idMap.GetConst(id);
+		return View<true, WriteMode::Copy, TQueries...>(*this, index, index + 1);
+	}
+
+	// Copies of read-only components of one object without building a view. They are read while the iterators pin
+	// the blocks, since a Copy mode writer may retire a block as soon as they're gone. Hold a view from GetViewAt
+	// to read the components in place
+	template<typename... TQueries> requires (std::is_const_v<TQueries> && ...)
+	std::optional<std::tuple<std::remove_const_t<TQueries>...>> TryGet(std::size_t id)
+	{
+		std::shared_lock lock(m_viewCreationLock);
 
-		if (m_deletedBits.Get(index))
-			return View<true, TQueries...>(*this, -1, -1);
+		auto index = FindIndex(id);
+		if (index == NO_INDEX)
+			return std::nullopt;
 
-		return View<true, TQueries...>(*this, index, std::min(index + 1, m_curCount.load()));
+		return std::tuple<std::remove_const_t<TQueries>...>(
+			static_cast<std::remove_const_t<TQueries>>(*std::get<ComponentStore<std::remove_const_t<TQueries>>>(m_stores).template GetIterator<TQueries>(index))...
+		);
+	}
+
+	// Deletes every object of a view of this store, e.g. one returned by Emplace. Unfiltered views are a single
+	// index range, set a word at a time
+	template<bool RefCounted, WriteMode Mode, typename... TQueries>
+	void DeleteRange(View<RefCounted, Mode, TQueries...>& view)
+	{
+		if (view.GetChangeFilter().FindChanged)
+		{
+			DeleteWhere(view, [](auto&&...) { return true; });
+			return;
+		}
+
+		auto endIndex = std::min(view.GetEndIndex(), m_curCount.load());
+		if (view.GetBeginIndex() < endIndex)
+			m_deletedBits.SetRange(view.GetBeginIndex(), endIndex);
+	}
+
+	// Deletes the objects of the view the predicate accepts, it is called with the view's components like a query
+	// loop would see them. Returns how many were deleted
+	template<bool RefCounted, WriteMode Mode, typename... TQueries, typename TPredicate>
+	std::size_t DeleteWhere(View<RefCounted, Mode, TQueries...>& view, TPredicate&& predicate)
+	{
+		WordBatch batch(m_deletedBits);
+
+		// Walks chunks rather than objects, the predicate reads straight out of the spans
+		for (auto cur = view.ChunksBegin(), end = view.ChunksEnd(); cur != end; ++cur)
+		{
+			auto chunk = *cur;
+
+			for (std::size_t word = 0; word * 64 < chunk.Count; ++word)
+			{
+				for (auto live = chunk.GetLiveMask(word); live != 0; live &= live - 1)
+				{
+					auto offset = word * 64 + std::countr_zero(live);
+					auto accepted = std::apply([&](const auto&... span) { return predicate(span[offset]...); }, chunk.Spans);
+
+					if (accepted)
+						batch.Add(chunk.FirstIndex + offset);
+				}
+			}
+		}
+
+		return batch.Flush();
 	}
 private:
-	AtomicBitset<MAX_ENTRIES> m_deletedBits;
+	template<typename T, ComponentCompatible... TSourceTs, typename... TAdded>
+	void MoveColumn(ParallelPooledStore<TSourceTs...>& source, const std::vector<std::size_t>& sourceIndices, std::size_t first, const TAdded&... added)
+	{
+		if constexpr (!TagComponent<T>)
+		{
+			auto cur = std::get<ComponentStore<T>>(m_stores).template GetIterator<T, WriteMode::Unlocked>(first);
+
+			if constexpr ((std::same_as<T, TAdded> || ...))
+			{
+				const T& value = std::get<const T&>(std::tie(added...));
+
+				for (std::size_t i = 0; i < sourceIndices.size(); ++i, ++cur)
+					*cur = value;
+			}
+			else if constexpr ((std::same_as<T, TSourceTs> || ...))
+			{
+				auto& sourceStore = std::get<ComponentStore<T>>(source.m_stores);
+
+				for (auto index : sourceIndices)
+				{
+					*cur = static_cast<T>(*sourceStore.template GetIterator<const T>(index));
+					++cur;
+				}
+			}
+			else
+			{
+				// Recycled blocks still hold the values of deleted objects
+				for (std::size_t i = 0; i < sourceIndices.size(); ++i, ++cur)
+					*cur = T{};
+			}
+		}
+	}
+
+	// Largest block of the components that hold data, the unit of SortBy's work
+	static constexpr std::size_t SORT_BLOCK_SIZE = std::max({
+		PooledStore<std::size_t>::T_PER_BLOCK,
+		(TagComponent<Ts> || PackedBoolComponent<Ts> ? std::size_t(1) : ComponentStore<Ts>::T_PER_BLOCK)...
+	});
+
+	struct SortEntry
+	{
+		bool Deleted;
+		std::uint64_t Key;
+		std::size_t Slot;
+
+		auto operator<=>(const SortEntry&) const = default;
+	};
+
+	// Reads keys of the next runs of objects and sorts each run, returns the budget left
+	template<typename TComponent, typename TKeyFunc>
+	std::size_t GatherSortRuns(TKeyFunc& keyFn, std::size_t budget)
+	{
+		auto cur = std::get<ComponentStore<TComponent>>(m_stores).template GetIterator<const TComponent>(m_sortEntries.size());
+
+		while (budget > 0 && m_sortEntries.size() < m_sortCount)
+		{
+			auto runBegin = m_sortEntries.size();
+			auto runEnd = std::min(runBegin + SORT_BLOCK_SIZE, m_sortCount);
+
+			for (auto slot = runBegin; slot < runEnd; ++slot, ++cur)
+			{
+				m_sortEntries.push_back({ m_deletedBits.Get(slot), static_cast<std::uint64_t>(keyFn(static_cast<TComponent>(*cur))), slot });
+				m_sortSlots.push_back(slot);
+				m_sortOrigins.push_back(slot);
+			}
+
+			std::sort(m_sortEntries.begin() + runBegin, m_sortEntries.end());
+			budget -= std::min(budget, runEnd - runBegin);
+		}
+
+		return budget;
+	}
+
+	// Merges pairs of sorted runs into runs twice as long, resuming mid-pair, returns the budget left
+	std::size_t MergeSortRuns(std::size_t budget)
+	{
+		m_sortMerged.resize(m_sortCount);
+
+		while (budget > 0 && m_sortWidth < m_sortCount)
+		{
+			auto pairBegin = m_sortCursor - m_sortCursor % (2 * m_sortWidth);
+			auto middle = std::min(pairBegin + m_sortWidth, m_sortCount);
+			auto pairEnd = std::min(pairBegin + 2 * m_sortWidth, m_sortCount);
+
+			if (m_sortCursor == pairBegin)
+			{
+				m_sortLeft = pairBegin;
+				m_sortRight = middle;
+			}
+
+			for (; budget > 0 && m_sortCursor < pairEnd; --budget, ++m_sortCursor)
+			{
+				if (m_sortRight == pairEnd || (m_sortLeft < middle && m_sortEntries[m_sortLeft] < m_sortEntries[m_sortRight]))
+					m_sortMerged[m_sortCursor] = m_sortEntries[m_sortLeft++];
+				else
+					m_sortMerged[m_sortCursor] = m_sortEntries[m_sortRight++];
+			}
+
+			if (m_sortCursor == m_sortCount)
+			{
+				std::swap(m_sortEntries, m_sortMerged);
+				m_sortWidth *= 2;
+				m_sortCursor = 0;
+			}
+		}
+
+		return budget;
+	}
+
+	// Swaps objects into their sorted slots front to back, up to budget swaps. Returns true once every slot is done
+	bool ApplySortOrder(std::size_t budget)
+	{
+		for (; m_sortCursor < m_sortCount; ++m_sortCursor)
+		{
+			auto origin = m_sortEntries[m_sortCursor].Slot;
+			auto slot = m_sortSlots[origin];
+
+			if (slot == m_sortCursor)
+				continue;
+
+			if (budget-- == 0)
+				return false;
+
+			SwapObjects(m_sortCursor, slot);
+
+			auto displaced = m_sortOrigins[m_sortCursor];
+			m_sortOrigins[m_sortCursor] = origin;
+			m_sortSlots[origin] = m_sortCursor;
+			m_sortOrigins[slot] = displaced;
+			m_sortSlots[displaced] = slot;
+		}
+
+		return true;
+	}
+
+	void ResetSort()
+	{
+		m_sortEntries = {};
+		m_sortMerged = {};
+		m_sortSlots = {};
+		m_sortOrigins = {};
+		m_sortCount = 0;
+		m_sortCursor = 0;
+	}
+
+	// Only called with the view creation lock held and no views open
+	void SwapObjects(std::size_t a, std::size_t b)
+	{
+		std::apply([&](PooledStore<std::size_t>& idStore, ComponentStore<Ts>&... elem)
+		{
+			SwapValues<std::size_t>(idStore, a, b);
+			(SwapValues<Ts>(elem, a, b), ...);
+
+			SetIdMapEntry(*idStore.template GetIterator<const std::size_t>(a), a);
+			SetIdMapEntry(*idStore.template GetIterator<const std::size_t>(b), b);
+		}, m_stores);
+
+		bool deletedA = m_deletedBits.Get(a);
+		m_deletedBits.Set(a, m_deletedBits.Get(b));
+		m_deletedBits.Set(b, deletedA);
+	}
+
+	template<typename T>
+	static void SwapValues(ComponentStore<T>& store, std::size_t a, std::size_t b)
+	{
+		if constexpr (!TagComponent<T>)
+		{
+			auto value = static_cast<T>(*store.template GetIterator<const T>(a));
+			*store.template GetIterator<T, WriteMode::Unlocked>(a) = static_cast<T>(*store.template GetIterator<const T>(b));
+			*store.template GetIterator<T, WriteMode::Unlocked>(b) = value;
+		}
+	}
+
+	// Id map entries hold the object's index with the id's generation above it
+	void SetIdMapEntry(std::size_t id, std::size_t index)
+	{
+		const_cast<std::atomic_size_t&>(*m_idMap.GetConst(id & ID_MASK)) = index | (id & GENERATION_MASK);
+	}
+
+	// Collects indices falling in the same word of the deleted bits and sets them together
+	class WordBatch
+	{
+	public:
+		WordBatch(AtomicBitset& bits) : m_bits(bits), m_wordIndex(AtomicBitset::NO_ONE), m_mask(0), m_count(0)
+		{
+		}
+
+		~WordBatch()
+		{
+			Flush();
+		}
+
+		void Add(std::size_t index)
+		{
+			if (index / 64 != m_wordIndex)
+			{
+				Flush();
+				m_wordIndex = index / 64;
+			}
+
+			m_mask |= 1ull << (index % 64);
+		}
+
+		// Total number of bits newly set so far
+		std::size_t Flush()
+		{
+			if (m_mask != 0)
+				m_count += m_bits.SetWordBits(m_wordIndex * 64, m_mask);
+
+			m_mask = 0;
+			return m_count;
+		}
+	private:
+		AtomicBitset& m_bits;
+		std::size_t m_wordIndex;
+		std::uint64_t m_mask;
+		std::size_t m_count;
+	};
+
+	template<ComponentCompatible... TOthers>
+	friend class ParallelPooledStore;
+
+	AtomicBitset m_deletedBits;
 	PooledStore<std::atomic_size_t> m_idMap;
 	std::atomic_size_t m_idMapSize;
 	std::size_t m_prefix;
 
-	std::tuple<PooledStore<std::size_t>, PooledStore<Ts>...> m_stores;
+	std::tuple<PooledStore<std::size_t>, ComponentStore<Ts>...> m_stores;
 	std::atomic_size_t m_curCount;
 
 	std::shared_mutex m_viewCreationLock;
 	std::atomic_size_t m_refCount;
 
-	void ExclusiveCleanup()
+	CompactionBudget m_compactionBudget;
+	std::atomic_size_t m_movedCount;
+	std::atomic_size_t m_sliceCount;
+	std::atomic_size_t m_skippedCount;
+	std::atomic_size_t m_maxSliceMicroseconds;
+
+	// State of the SortBy pass in progress. Entries hold the snapshot of keys being merge sorted, slots and origins
+	// track where each snapshot object currently is and which one each slot holds while they are swapped into place
+	std::vector<SortEntry> m_sortEntries;
+	std::vector<SortEntry> m_sortMerged;
+	std::vector<std::size_t> m_sortSlots;
+	std::vector<std::size_t> m_sortOrigins;
+	std::size_t m_sortCount = 0;
+	std::size_t m_sortMovedCount = 0;
+	std::size_t m_sortWidth = 0;
+	std::size_t m_sortCursor = 0;
+	std::size_t m_sortLeft = 0;
+	std::size_t m_sortRight = 0;
+
+	template<typename... TChanged>
+	ChangeFilter CreateChangeFilter(std::type_identity<Archetype<TChanged...>>, ChangeVersion since, std::size_t end)
+	{
+		static constexpr std::size_t granularity = std::min({ ComponentStore<TChanged>::T_PER_BLOCK... });
+
+		auto findChanged = [this, since](std::size_t index, std::size_t end)
+		{
+			for (auto cur = index / granularity * granularity; cur < end; cur += granularity)
+			{
+				if (((std::get<ComponentStore<TChanged>>(m_stores).GetBlockVersion(cur) >= since) || ...))
+					return std::max(cur, index);
+			}
+
+			return end;
+		};
+
+		return { findChanged, granularity, end };
+	}
+
+	// Called with the view creation lock held and no views open
+	bool CompactSlice(const CompactionBudget& budget)
 	{
+		auto start = std::chrono::steady_clock::now();
+		std::size_t moved = 0;
+
 		auto fun =
-			[&](PooledStore<std::size_t>& idStore, PooledStore<Ts>&... elem)
+			[&](PooledStore<std::size_t>& idStore, ComponentStore<Ts>&... elem)
 			{
-				idStore.ReclaimBlocks();
-				(elem.ReclaimBlocks(), ...);
-
-				// break constness since this function is only accessed at a sync point (ref count == 0)
-				// so RCU will not make a copy
-				// 
-				// TODO: make this an easily accessible behavior so all systems have right to lock down a block at a sync point
-				// to avoid an potentially expensive copy, without having to use a const_cast hack
-				//
-				// However, it is unknown if a block copy is more expensive than waiting on a lock
-				// and if this functionality needs to be accessible outside of this use case
-				auto constView = View<false, const std::size_t, const Ts...>(*this, 0, m_curCount.load() - 1);
-				auto curIter = constView.begin();
-				auto endIter = constView.end();
-
-				for (std::size_t deletedIndex : m_deletedBits)
+				// No view is open, so blocks are written in place without a copy or lock.
+				// Both iterators may point into the same block, which rules out the locking InPlace mode
+				auto count = m_curCount.load();
+
+				// Dead ids stay in the slots past the end, to be reused by the next objects created there. Their new
+				// generation makes handles to the deleted objects stale
+				auto recycleId = [&](std::size_t index)
+				{
+					auto idIter = idStore.template GetIterator<std::size_t, WriteMode::Unlocked>(index);
+					*idIter = GetNextGeneration(*idIter);
+					SetIdMapEntry(*idIter, index);
+				};
+
+				// Fills holes with the last live object, front to back, until the budget runs out
+				auto deletedIndex = m_deletedBits.FindNextOne(0);
+				for (; deletedIndex < count; deletedIndex = m_deletedBits.FindNextOne(deletedIndex + 1))
 				{
-					curIter += deletedIndex - curIter.GetIndex();
+					if (moved == budget.MaxMoves)
+						break;
 
-					// TODO: Allow backward iterator of deleted bits to optimize this Get/Set process
-					
-					while (curIter <= endIter && deletedIndex < endIter.GetIndex() && m_deletedBits.Get(endIter.GetIndex()))
+					// The clock is only read every few moves
+					if (moved > 0 && moved % 64 == 0 && std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start) >= budget.MaxTime)
+						break;
+
+					// Drop the run of deleted objects at the tail, nothing needs to move into those slots
+					auto tailEnd = count;
+					for (std::size_t tailIndex : m_deletedBits.ReverseOnes(deletedIndex + 1, count))
 					{
-						m_deletedBits.Set(endIter.GetIndex(), false);
-						endIter += -1;
-						--m_curCount;
+						if (tailIndex != count - 1)
+							break;
+
+						--count;
 					}
 
-					if (curIter >= endIter)
+					m_deletedBits.ClearRange(count, tailEnd);
+					m_deletedBits.Set(deletedIndex, false);
+
+					for (auto tailIndex = count; tailIndex < tailEnd; ++tailIndex)
+						recycleId(tailIndex);
+
+					--count;
+					if (deletedIndex == count)
 					{
-						--m_curCount; // The deletedBits iterator has cleaned this up, so remove it from count
-						break;
+						recycleId(deletedIndex);
+						break; // Deleted object was the last one, nothing to move and no holes left
 					}
 
-					auto mutDeletedObj = std::apply([](const std::size_t& id, const Ts&... rest)
-					{ 
-						// Cast away constness of mutable object (to avoid unnecessary copy by RCU)
-						return std::forward_as_tuple(const_cast<std::size_t&>(id), const_cast<Ts&>(rest)...);
-					}, *curIter);
+					auto deadIter = idStore.template GetIterator<std::size_t, WriteMode::Unlocked>(deletedIndex);
+					auto movedIter = idStore.template GetIterator<std::size_t, WriteMode::Unlocked>(count);
 
-					std::size_t deadId = std::get<std::size_t&>(mutDeletedObj); // Get id of deleted obj
-					mutDeletedObj = *endIter; // Move from right ptr to cur deleted free one (fill empty slot)
-					std::size_t movedId = std::get<std::size_t&>(mutDeletedObj); // Get id of moved object
+					std::size_t deadId = *deadIter;
+					std::size_t movedId = *movedIter;
 
-					const_cast<std::size_t&>(std::get<const std::size_t&>(*endIter)) = deadId; // Recycle dead id
-					const_cast<std::atomic_size_t&>(*m_idMap.GetConst(movedId & ID_MASK)) = deletedIndex; // Update index of moved obj
+					*deadIter = movedId;
+					*movedIter = GetNextGeneration(deadId);
+					SetIdMapEntry(movedId, deletedIndex);
+					SetIdMapEntry(GetNextGeneration(deadId), count);
 
-					endIter += -1;
-					--m_curCount;
+					((*elem.template GetIterator<Ts, WriteMode::Unlocked>(deletedIndex) = *elem.template GetIterator<Ts, WriteMode::Unlocked>(count)), ...);
+					++moved;
 				}
+
+				m_curCount = count;
 			};
 
 		std::apply(fun, m_stores);
+
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+		m_movedCount += moved;
+		++m_sliceCount;
+		if (static_cast<std::size_t>(elapsed) > m_maxSliceMicroseconds)
+			m_maxSliceMicroseconds = elapsed;
+
+		return m_deletedBits.GetOneCount() == 0;
 	}
-};
\ No newline at end of file
+};
@@ -1,47 +1,82 @@
 #pragma once
 
 #include "MemoryPool.h"
+#include "EpochReclaimer.h"
+#include "RadixIndex.h"
+#include "SoaLayout.h"
+
+const size_t MIN_T_PER_BLOCK = 256; // Stores pick the smallest block size class holding at least this many elements
+const size_t INDEX_NODE_SIZE = BLOCK_SIZES[1];
+
+using ChangeVersion = std::uint64_t;
+using ChangeClock = std::atomic<ChangeVersion>;
+
+enum class WriteMode
+{
+	Copy,    // Writers copy the block and swap it in (RCU), readers are never blocked
+	InPlace, // Writers lock the block and mutate it directly, there must be no concurrent readers
+	Unlocked // Writers mutate blocks without locking, only for sync points where nothing else touches the store
+};
 
 template<typename T>
-concept StoreCompatible = sizeof(T) >= sizeof(size_t);
+concept StoreCompatible = sizeof(T) >= sizeof(size_t) && sizeof(T) <= MAX_BLOCK_SIZE;
 
 template<StoreCompatible T>
 class PooledStore
 {
-private:
-	static const std::size_t T_PER_BLOCK = BLOCK_SIZE / sizeof(T);
-	static const std::size_t MAX_INDICES_PER_STORE = 84;
+public:
+	static const std::size_t BLOCK_BYTES = GetBlockSizeFor(sizeof(T), MIN_T_PER_BLOCK);
+	static const std::size_t T_PER_BLOCK = std::bit_floor(BLOCK_BYTES / sizeof(T));
+
+	// Components with a SoaLayout are stored column by column inside each block (AoSoA)
+	static constexpr inline bool IsSoa = SoaComponent<T>;
+	static_assert(!IsSoa || std::is_trivially_copyable_v<T>, "SoA components must be trivially copyable!");
 
-	struct Block
+	// What dereferencing an iterator gives, a plain reference or a SoaReference proxy
+	template<typename TIter>
+	using Reference = std::conditional_t<IsSoa, SoaReference<TIter, T_PER_BLOCK>, TIter&>;
+
+	// A run of components inside one block, a std::span or a SoaSpan of per-field arrays
+	template<typename TIter>
+	using Span = std::conditional_t<IsSoa, SoaSpan<TIter, T_PER_BLOCK>, std::span<TIter>>;
+private:
+	struct AosBlock
 	{
 		T Data[T_PER_BLOCK];
 	};
 
-	static const std::size_t BLOCKS_PER_INDEX = (BLOCK_SIZE) / (2 * sizeof(std::atomic<Block *>));
-	static const std::size_t T_PER_INDEX = T_PER_BLOCK * BLOCKS_PER_INDEX;
+	struct SoaBlock
+	{
+		alignas(T) std::byte Data[SoaLayout<T>::template GetBlockBytes<T_PER_BLOCK>()];
+	};
+
+	using Block = std::conditional_t<IsSoa, SoaBlock, AosBlock>;
+
+	static const std::size_t BLOCKS_PER_INDEX = std::bit_floor(
+		INDEX_NODE_SIZE / (sizeof(std::shared_mutex) + sizeof(MemoryPool::Ptr<Block>) + sizeof(ChangeClock))
+	);
 
 	struct BlockIndexNode
 	{
 		std::shared_mutex WriterLock[BLOCKS_PER_INDEX];
 		MemoryPool::Ptr<Block> Block[BLOCKS_PER_INDEX];
+		ChangeClock Version[BLOCKS_PER_INDEX]; // Version of the last write to each block, 0 if never written
 	};
 
-	static std::tuple<std::int32_t, std::int16_t, std::int16_t> GetInternalIndices(std::size_t index)
+	static std::tuple<std::size_t, std::size_t, std::size_t> GetInternalIndices(std::size_t index)
 	{
-		auto [indexNodeIndex, indexNodeOffset] = std::div(static_cast<long long>(index), T_PER_INDEX);
-		auto [blockIndex, blockOffset] = std::div(static_cast<long long>(indexNodeOffset), T_PER_BLOCK);
-
-		return { indexNodeIndex, blockIndex, blockOffset };
+		// Both counts are powers of two, so this is all shifts and masks
+		return { index / T_PER_INDEX, index % T_PER_INDEX / T_PER_BLOCK, index % T_PER_BLOCK };
 	}
 public:
-	static const std::size_t MAX_T_PER_STORE = MAX_INDICES_PER_STORE * T_PER_INDEX;
+	static const std::size_t T_PER_INDEX = T_PER_BLOCK * BLOCKS_PER_INDEX;
 
-	template<typename TIter> requires std::same_as<T, TIter> || std::same_as<const T, TIter>
+	template<typename TIter, WriteMode Mode = WriteMode::Copy> requires std::same_as<T, TIter> || std::same_as<const T, TIter>
 	class Iterator
 	{
 	public:
-		using iterator = Iterator<TIter>;
-		using reference = TIter&;
+		using iterator = Iterator<TIter, Mode>;
+		using reference = Reference<TIter>;
 		using pointer = TIter *;
 
 		using iterator_category = std::bidirectional_iterator_tag;
@@ -49,8 +84,10 @@ public:
 		using difference_type = std::ptrdiff_t;
 
 		static constexpr inline bool IsConst = std::is_const_v<TIter>;
+		static constexpr inline bool IsLocking = !IsConst && Mode != WriteMode::Unlocked;
+		static constexpr inline bool IsCopying = !IsConst && Mode == WriteMode::Copy;
 
-		Iterator(const Iterator<TIter>& other)
+		Iterator(const iterator& other)
 		{
 			m_store = other.m_store;
 			m_updateBlock = nullptr;
@@ -64,8 +101,11 @@ public:
 			m_curTIndex = other.m_curTIndex;
 		}
 
-		Iterator<TIter>& operator=(const Iterator<TIter>& other)
+		iterator& operator=(const iterator& other)
 		{
+			if (!IsConst && !m_undefinedBlock)
+				FlushUpdateBlock();
+
 			m_store = other.m_store;
 			m_updateBlock = nullptr;
 			m_undefinedBlock = true;
@@ -76,17 +116,24 @@ public:
 			m_curNodeIndex = other.m_curNodeIndex;
 			m_curBlockIndex = other.m_curBlockIndex;
 			m_curTIndex = other.m_curTIndex;
+
+			return *this;
 		}
 
-		Iterator(Iterator<TIter>&& other)
+		Iterator(iterator&& other)
 		{
 			m_store = other.m_store;
 			m_updateBlock = std::move(other.m_updateBlock);
 			m_undefinedBlock = other.m_undefinedBlock;
+			m_guard = other.m_guard;
+
+			// The block lock (if any) now belongs to this iterator
+			other.m_undefinedBlock = true;
 
 			m_curNode = other.m_curNode;
 			m_curBlock = other.m_curBlock;
-			m_curT = other.m_curT;
+			if constexpr (!IsSoa)
+				m_curT = other.m_curT;
 
 			m_curIndex = other.m_curIndex;
 			m_curNodeIndex = other.m_curNodeIndex;
@@ -94,20 +141,30 @@ public:
 			m_curTIndex = other.m_curTIndex;
 		}
 
-		Iterator<TIter>& operator=(Iterator<TIter>&& other)
+		iterator& operator=(iterator&& other)
 		{
+			if (!IsConst && !m_undefinedBlock)
+				FlushUpdateBlock();
+
 			m_store = other.m_store;
 			m_updateBlock = std::move(other.m_updateBlock);
 			m_undefinedBlock = other.m_undefinedBlock;
+			m_guard = other.m_guard;
+
+			// The block lock (if any) now belongs to this iterator
+			other.m_undefinedBlock = true;
 
 			m_curNode = other.m_curNode;
 			m_curBlock = other.m_curBlock;
-			m_curT = other.m_curT;
+			if constexpr (!IsSoa)
+				m_curT = other.m_curT;
 
 			m_curIndex = other.m_curIndex;
 			m_curNodeIndex = other.m_curNodeIndex;
 			m_curBlockIndex = other.m_curBlockIndex;
 			m_curTIndex = other.m_curTIndex;
+
+			return *this;
 		}
 
 		Iterator(PooledStore<T>& store, std::size_t index) :
@@ -127,18 +184,18 @@ public:
 
 		~Iterator()
 		{
-			if (!m_undefinedBlock && m_updateBlock)
+			if (!IsConst && !m_undefinedBlock)
 				FlushUpdateBlock();
 		}
 
 		auto AsConst()
 		{
-			return Iterator<std::add_const_t<TIter>>(*m_store, m_curIndex);
+			return Iterator<std::add_const_t<TIter>, Mode>(*m_store, m_curIndex);
 		}
 
 		auto AsMutable()
 		{
-			return Iterator<std::remove_const_t<TIter>>(*m_store, m_curIndex);
+			return Iterator<std::remove_const_t<TIter>, Mode>(*m_store, m_curIndex);
 		}
 
 		iterator operator++(int)
@@ -196,15 +253,30 @@ public:
 		reference operator*() const
 		{
 			// Hack to get around iterator rules
-			const_cast<PooledStore<T>::template Iterator<TIter> *>(this)->Deref();
-			return *m_curT;
+			const_cast<iterator *>(this)->Deref();
+
+			if constexpr (IsSoa)
+				return reference(m_curBlock->Data, m_curTIndex);
+			else
+				return *m_curT;
 		}
 
-		pointer operator->()
+		pointer operator->() requires (!IsSoa)
 		{
 			return &(**this);
 		}
 
+		// The next count components starting at this one, which must all be in the current block
+		Span<TIter> GetSpan(std::size_t count) const
+		{
+			const_cast<iterator *>(this)->Deref();
+
+			if constexpr (IsSoa)
+				return Span<TIter>(m_curBlock->Data, m_curTIndex, count);
+			else
+				return Span<TIter>(m_curT, count);
+		}
+
 		auto operator<=>(const iterator& other) const
 		{
 			return m_curIndex <=> other.m_curIndex;
@@ -222,6 +294,9 @@ public:
 	private:
 		PooledStore<T> *m_store;
 
+		// Pins the epoch while this iterator points into a block, so the block can't be reclaimed under it
+		std::optional<EpochReclaimer::Guard> m_guard;
+
 		MemoryPool::Ptr<Block> m_updateBlock;
 		bool m_undefinedBlock;
 
@@ -239,22 +314,30 @@ public:
 			[[unlikely]]
 			if (m_undefinedBlock)
 			{
-				m_curNode = m_store->m_nodes[m_curNodeIndex].Load();
-				if constexpr (!IsConst)
-				{
-					m_updateBlock = MemoryPool::RequestBlock<Block>();
+				m_guard.emplace();
+				m_curNode = m_store->m_index.Find(m_curNodeIndex);
+
+				if constexpr (IsCopying)
+					m_updateBlock = MemoryPool::RequestBlock<Block>(m_store->m_node);
+
+				if constexpr (IsLocking)
 					m_curNode->WriterLock[m_curBlockIndex].lock();
-				}
 
 				m_curBlock = m_curNode->Block[m_curBlockIndex].Load();
 
-				if constexpr (!IsConst)
+				if constexpr (IsCopying)
 				{
-					std::copy_n(reinterpret_cast<T *>(m_curBlock->Data), T_PER_BLOCK, reinterpret_cast<T *>(m_updateBlock->Data));
+					// SoA components are trivially copyable, so their columns are copied as raw bytes
+					if constexpr (IsSoa)
+						std::copy_n(m_curBlock->Data, sizeof(m_curBlock->Data), m_updateBlock->Data);
+					else
+						std::copy_n(reinterpret_cast<T *>(m_curBlock->Data), T_PER_BLOCK, reinterpret_cast<T *>(m_updateBlock->Data));
+
 					m_curBlock = m_updateBlock.Load();
 				}
 
-				m_curT = reinterpret_cast<TIter *>(m_curBlock->Data) + m_curTIndex;
+				if constexpr (!IsSoa)
+					m_curT = reinterpret_cast<TIter *>(m_curBlock->Data) + m_curTIndex;
 
 				m_undefinedBlock = false;
 			}
@@ -262,10 +345,18 @@ public:
 
 		void FlushUpdateBlock()
 		{
+			if constexpr (!IsConst)
+				m_curNode->Version[m_curBlockIndex] = m_store->GetCurrentVersion();
+
 			// RCU swap here
-			m_curNode->Block[m_curBlockIndex].WeakSwap(m_updateBlock);
-			m_curNode->WriterLock[m_curBlockIndex].unlock();
-			m_store->m_reclaimList.push(std::move(m_updateBlock));
+			if constexpr (IsCopying)
+				m_curNode->Block[m_curBlockIndex].WeakSwap(m_updateBlock);
+
+			if constexpr (IsLocking)
+				m_curNode->WriterLock[m_curBlockIndex].unlock();
+
+			if constexpr (IsCopying)
+				EpochReclaimer::Retire(std::move(m_updateBlock));
 		}
 
 		void Next(std::size_t offset)
@@ -279,13 +370,15 @@ public:
 				if (!IsConst && !m_undefinedBlock)
 					FlushUpdateBlock();
 				m_undefinedBlock = true;
+				m_guard.reset();
 				m_curNodeIndex = nextNode;
 				m_curBlockIndex = nextBlock;
 			}
 			else if (!m_undefinedBlock)
 			{
 				// Block already in use
-				m_curT = m_curBlock->Data + nextOffset;
+				if constexpr (!IsSoa)
+					m_curT = m_curBlock->Data + nextOffset;
 			}
 
 			m_curTIndex = nextOffset;
@@ -295,6 +388,7 @@ public:
 
 	using MutableIterator = Iterator<T>;
 	using ConstIterator = Iterator<const T>;
+	using ExclusiveIterator = Iterator<T, WriteMode::InPlace>;
 
 	PooledStore();
 	PooledStore(const PooledStore<T>&) = delete;
@@ -303,65 +397,65 @@ public:
 	MutableIterator Emplace(std::size_t firstIndex, std::size_t count, std::size_t prefix=0);
 	MutableIterator Get(std::size_t index);
 	ConstIterator GetConst(std::size_t index);
-	void ReclaimBlocks();
 
-	template<typename T>
-	Iterator<T> GetIterator(std::size_t index)
+	// Writes through the returned iterator skip the RCU copy, so the caller must ensure nothing reads the store meanwhile
+	ExclusiveIterator GetExclusive(std::size_t index);
+
+	// Pins blocks allocated from now on to a NUMA node, ANY_NUMA_NODE follows the allocating thread
+	void SetPreferredNode(std::size_t node);
+
+	// Written blocks are stamped with the clock's current version, or 1 if no clock is set
+	void SetChangeClock(const ChangeClock *clock);
+	ChangeVersion GetBlockVersion(std::size_t index);
+
+	template<typename TIter, WriteMode Mode = WriteMode::Copy>
+	Iterator<TIter, Mode> GetIterator(std::size_t index)
 	{
-		return Iterator<T>(*this, index);
+		return Iterator<TIter, Mode>(*this, index);
 	}
 private:
-	std::array<MemoryPool::Ptr<BlockIndexNode>, MAX_INDICES_PER_STORE> m_nodes;
-	concurrency::concurrent_queue<MemoryPool::Ptr<Block>> m_reclaimList;
+	RadixIndex<BlockIndexNode> m_index; // Grows on demand, a store smaller than T_PER_INDEX only has one node
+	std::size_t m_node;
+	const ChangeClock *m_changeClock;
+
+	ChangeVersion GetCurrentVersion() const;
 };
 
 template<StoreCompatible T>
-inline PooledStore<T>::PooledStore()
+inline PooledStore<T>::PooledStore() : m_node(ANY_NUMA_NODE), m_changeClock(nullptr)
 {
 }
 
 template<StoreCompatible T>
 inline PooledStore<T>::MutableIterator PooledStore<T>::Emplace(std::size_t firstIndex, std::size_t count, std::size_t prefix)
 {
+	if (count == 0)
+		return MutableIterator(*this, firstIndex);
+
 	auto [firstNode, firstBlock, firstOffset] = GetInternalIndices(firstIndex);
 	auto [lastNode, lastBlock, lastOffset] = GetInternalIndices(firstIndex + count - 1);
+	auto version = GetCurrentVersion();
 
 	// TODO: optimize this loop
 	for (std::size_t nodeIndex = firstNode; nodeIndex <= lastNode; ++nodeIndex)
 	{
-		auto& node = m_nodes[nodeIndex];
-
 		std::size_t blockIndex = nodeIndex > firstNode ? 0 : firstBlock;
-		std::size_t lastBlockIndex = nodeIndex < lastNode ? BLOCKS_PER_INDEX : lastBlock;
-
-		if (!node)
-		{
-			if (blockIndex == 0)
-			{
-				node = MemoryPool::RequestBlock<BlockIndexNode>();
-				node.NotifyNonnull();
-			}
-			else
-			{
-				node.WaitNonnull();
-			}
-		}
+		std::size_t lastBlockIndex = nodeIndex < lastNode ? BLOCKS_PER_INDEX - 1 : lastBlock;
 
-		auto loadedNode = node.Load();
+		auto loadedNode = m_index.FindOrCreate(nodeIndex, m_node);
 
 		for (; blockIndex <= lastBlockIndex; ++blockIndex)
 		{
-			auto& lock = loadedNode->WriterLock[blockIndex];
 			auto& block = loadedNode->Block[blockIndex];
 
-			std::size_t offset = blockIndex > firstBlock && nodeIndex > firstNode ? 0 : firstOffset;
-			std::size_t lastOffsetIndex = blockIndex < lastBlock && nodeIndex < lastNode ? T_PER_BLOCK : lastOffset;
+			// Only the first block can be shared with a previous Emplace, every other one starts at offset 0
+			std::size_t offset = nodeIndex == firstNode && blockIndex == firstBlock ? firstOffset : 0;
 
 			if (!block)
 			{
 				if (offset == 0)
 				{
-					auto newBlock = MemoryPool::RequestBlock<Block>();
+					auto newBlock = MemoryPool::RequestBlock<Block>(m_node);
 
 					if constexpr (std::same_as<std::size_t, T>)
 					{
@@ -378,6 +472,8 @@ inline PooledStore<T>::MutableIterator PooledStore<T>::Emplace(std::size_t first
 					block.WaitNonnull();
 				}
 			}
+
+			loadedNode->Version[blockIndex] = version;
 		}
 	}
 
@@ -397,7 +493,37 @@ inline PooledStore<T>::ConstIterator PooledStore<T>::GetConst(std::size_t index)
 }
 
 template<StoreCompatible T>
-inline void PooledStore<T>::ReclaimBlocks()
+inline PooledStore<T>::ExclusiveIterator PooledStore<T>::GetExclusive(std::size_t index)
+{
+	return GetIterator<T, WriteMode::InPlace>(index);
+}
+
+template<StoreCompatible T>
+inline void PooledStore<T>::SetPreferredNode(std::size_t node)
+{
+	m_node = node;
+}
+
+template<StoreCompatible T>
+inline void PooledStore<T>::SetChangeClock(const ChangeClock *clock)
+{
+	m_changeClock = clock;
+}
+
+template<StoreCompatible T>
+inline ChangeVersion PooledStore<T>::GetBlockVersion(std::size_t index)
+{
+	auto [nodeIndex, blockIndex, offset] = GetInternalIndices(index);
+
+	auto node = m_index.Find(nodeIndex);
+	if (!node)
+		return 0;
+
+	return node->Version[blockIndex].load(std::memory_order_relaxed);
+}
+
+template<StoreCompatible T>
+inline ChangeVersion PooledStore<T>::GetCurrentVersion() const
 {
-	m_reclaimList.clear();
+	return m_changeClock ? m_changeClock->load(std::memory_order_relaxed) : 1;
 }
\ No newline at end of file
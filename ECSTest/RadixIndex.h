@@ -0,0 +1,188 @@
+#pragma once
+
+#include "MemoryPool.h"
+
+// Maps leaf indices to pool blocks through a tree of directory blocks. The tree gains a level on top whenever an
+// index past its capacity is requested, with the old root becoming the first child of the new one, so a small
+// index is just its single leaf. Readers never lock, an outdated root is still a valid subtree of the current one
+template<BlockSized TLeaf>
+class RadixIndex
+{
+public:
+	RadixIndex();
+	~RadixIndex();
+
+	RadixIndex(const RadixIndex<TLeaf>&) = delete;
+	RadixIndex& operator=(const RadixIndex<TLeaf>&) = delete;
+
+	// Null if the leaf hasn't been created
+	TLeaf *Find(std::size_t index);
+
+	// Leaves and directories are allocated on the given node, concurrent callers agree on a single leaf per index
+	TLeaf *FindOrCreate(std::size_t index, std::size_t node = ANY_NUMA_NODE);
+private:
+	static const std::size_t FAN_OUT = BLOCK_SIZE / sizeof(std::atomic<void *>);
+	static const std::size_t FAN_OUT_BITS = std::countr_zero(FAN_OUT);
+
+	// Pool blocks are at least 4KB aligned, so the low bits of the root hold the tree's height
+	static const std::uintptr_t HEIGHT_MASK = 0xF;
+
+	struct Directory
+	{
+		std::atomic<void *> Children[FAN_OUT] = {};
+	};
+
+	std::atomic_uintptr_t m_root;
+
+	static std::size_t GetChildIndex(std::size_t index, std::size_t height);
+	static bool IsInRange(std::size_t index, std::size_t height);
+
+	template<typename T>
+	static void *Allocate(std::size_t node);
+	template<typename T>
+	static void Free(void *block);
+
+	static void FreeTree(void *node, std::size_t height);
+};
+
+template<BlockSized TLeaf>
+inline RadixIndex<TLeaf>::RadixIndex() : m_root(0)
+{
+}
+
+template<BlockSized TLeaf>
+inline RadixIndex<TLeaf>::~RadixIndex()
+{
+	auto root = m_root.load();
+	FreeTree(reinterpret_cast<void *>(root & ~HEIGHT_MASK), root & HEIGHT_MASK);
+}
+
+template<BlockSized TLeaf>
+inline TLeaf *RadixIndex<TLeaf>::Find(std::size_t index)
+{
+	auto root = m_root.load();
+	auto height = root & HEIGHT_MASK;
+	auto node = reinterpret_cast<void *>(root & ~HEIGHT_MASK);
+
+	if (!IsInRange(index, height))
+		return nullptr;
+
+	for (; height > 0 && node; --height)
+		node = static_cast<Directory *>(node)->Children[GetChildIndex(index, height)].load();
+
+	return static_cast<TLeaf *>(node);
+}
+
+template<BlockSized TLeaf>
+inline TLeaf *RadixIndex<TLeaf>::FindOrCreate(std::size_t index, std::size_t node)
+{
+	auto root = m_root.load();
+
+	// Add levels on top until the index fits
+	void *newRoot = nullptr;
+	while (!IsInRange(index, root & HEIGHT_MASK))
+	{
+		if (!newRoot)
+			newRoot = Allocate<Directory>(node);
+
+		static_cast<Directory *>(newRoot)->Children[0] = reinterpret_cast<void *>(root & ~HEIGHT_MASK);
+
+		auto grown = reinterpret_cast<std::uintptr_t>(newRoot) | ((root & HEIGHT_MASK) + 1);
+		if (m_root.compare_exchange_strong(root, grown))
+		{
+			root = grown;
+			newRoot = nullptr;
+		}
+	}
+
+	if (newRoot)
+		Free<Directory>(newRoot);
+
+	auto height = root & HEIGHT_MASK;
+
+	[[unlikely]]
+	if (height == 0)
+	{
+		// The root is the only leaf
+		if (root != 0)
+			return reinterpret_cast<TLeaf *>(root);
+
+		auto leaf = Allocate<TLeaf>(node);
+		if (m_root.compare_exchange_strong(root, reinterpret_cast<std::uintptr_t>(leaf)))
+			return static_cast<TLeaf *>(leaf);
+
+		// Lost to another leaf or to a new level, either way the tree now has what is needed
+		Free<TLeaf>(leaf);
+		return FindOrCreate(index, node);
+	}
+
+	auto directory = reinterpret_cast<Directory *>(root & ~HEIGHT_MASK);
+	for (; height > 0; --height)
+	{
+		auto& slot = directory->Children[GetChildIndex(index, height)];
+		auto child = slot.load();
+
+		if (!child)
+		{
+			auto created = height > 1 ? Allocate<Directory>(node) : Allocate<TLeaf>(node);
+
+			if (slot.compare_exchange_strong(child, created))
+				child = created;
+			else if (height > 1)
+				Free<Directory>(created);
+			else
+				Free<TLeaf>(created);
+		}
+
+		if (height == 1)
+			return static_cast<TLeaf *>(child);
+
+		directory = static_cast<Directory *>(child);
+	}
+
+	return nullptr;
+}
+
+template<BlockSized TLeaf>
+inline std::size_t RadixIndex<TLeaf>::GetChildIndex(std::size_t index, std::size_t height)
+{
+	return (index >> (FAN_OUT_BITS * (height - 1))) & (FAN_OUT - 1);
+}
+
+template<BlockSized TLeaf>
+inline bool RadixIndex<TLeaf>::IsInRange(std::size_t index, std::size_t height)
+{
+	return FAN_OUT_BITS * height >= 64 || (index >> (FAN_OUT_BITS * height)) == 0;
+}
+
+template<BlockSized TLeaf>
+template<typename T>
+inline void *RadixIndex<TLeaf>::Allocate(std::size_t node)
+{
+	return MemoryPool::RequestBlock<T>(node).Release();
+}
+
+template<BlockSized TLeaf>
+template<typename T>
+inline void RadixIndex<TLeaf>::Free(void *block)
+{
+	MemoryPool::Ptr<T> ptr(static_cast<T *>(block));
+}
+
+template<BlockSized TLeaf>
+inline void RadixIndex<TLeaf>::FreeTree(void *node, std::size_t height)
+{
+	if (!node)
+		return;
+
+	if (height == 0)
+	{
+		Free<TLeaf>(node);
+		return;
+	}
+
+	for (auto& child : static_cast<Directory *>(node)->Children)
+		FreeTree(child.load(), height - 1);
+
+	Free<Directory>(node);
+}
@@ -0,0 +1,497 @@
+#pragma once
+
+#include "PooledStore.h"
+
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Base of relation components, e.g. struct Parent : Relation {}. The object holding one points at Target, 0 for none
+struct Relation
+{
+	std::size_t Target = 0;
+};
+
+template<typename T>
+concept RelationComponent = std::derived_from<T, Relation>;
+
+// The (target, source) pairs of one relation component, sorted by target so a target's sources sit next to each
+// other, e.g. the children of an object. EcsStorage keeps it up to date from the blocks of the relation written since
+// the last update
+class RelationIndex
+{
+public:
+	using Pair = std::pair<std::size_t, std::size_t>; // Target, source
+
+	// Current targets of sources whose relation may have changed, 0 if they no longer have one. Returns the ones
+	// that did change
+	std::vector<Pair> Update(std::span<const Pair> changed);
+
+	// Drops the sources isAlive rejects once the index has doubled since the last prune, so the pass over it is paid
+	// for by the pairs added in between. Until then dead sources stay in the index. Returns the dropped sources
+	template<typename TIsAlive>
+	std::vector<std::size_t> Prune(TIsAlive&& isAlive);
+
+	std::span<const Pair> GetPairs() const;
+
+	// 0 if the object isn't a source
+	std::size_t GetTarget(std::size_t source) const;
+
+	// Sources pointing at the target
+	std::span<const Pair> GetSources(std::size_t target) const;
+
+	// Version of the last update, the next one only needs blocks written since
+	ChangeVersion GetVersion() const;
+	void SetVersion(ChangeVersion version);
+private:
+	std::vector<Pair> m_pairs;
+	std::unordered_map<std::size_t, std::size_t> m_targets; // By source
+	ChangeVersion m_version = 0;
+	std::size_t m_prunedSize = 0;
+
+	static inline constexpr std::size_t PRUNE_MIN_SIZE = 1024;
+};
+
+inline std::vector<RelationIndex::Pair> RelationIndex::Update(std::span<const Pair> changed)
+{
+	std::vector<Pair> removed;
+	std::vector<Pair> added;
+	std::vector<Pair> changes;
+
+	for (auto [target, source] : changed)
+	{
+		auto current = m_targets.find(source);
+		auto oldTarget = current == m_targets.end() ? 0 : current->second;
+
+		if (oldTarget == target)
+			continue;
+
+		changes.emplace_back(target, source);
+
+		if (oldTarget != 0)
+			removed.emplace_back(oldTarget, source);
+
+		if (target != 0)
+		{
+			added.emplace_back(target, source);
+			m_targets[source] = target;
+		}
+		else
+			m_targets.erase(current);
+	}
+
+	if (changes.empty())
+		return changes;
+
+	std::ranges::sort(removed);
+	std::ranges::sort(added);
+
+	// A source changing twice in one update adds a pair and removes it again
+	std::vector<Pair> kept;
+	std::ranges::set_difference(m_pairs, removed, std::back_inserter(kept));
+
+	std::vector<Pair> addedKept;
+	std::ranges::set_difference(added, removed, std::back_inserter(addedKept));
+
+	m_pairs.clear();
+	std::ranges::merge(kept, addedKept, std::back_inserter(m_pairs));
+
+	return changes;
+}
+
+template<typename TIsAlive>
+inline std::vector<std::size_t> RelationIndex::Prune(TIsAlive&& isAlive)
+{
+	std::vector<std::size_t> removed;
+	if (m_pairs.size() < std::max(2 * m_prunedSize, PRUNE_MIN_SIZE))
+		return removed;
+
+	std::erase_if(m_pairs, [&](const Pair& pair)
+	{
+		if (isAlive(pair.second))
+			return false;
+
+		m_targets.erase(pair.second);
+		removed.push_back(pair.second);
+		return true;
+	});
+
+	m_prunedSize = m_pairs.size();
+	return removed;
+}
+
+inline std::span<const RelationIndex::Pair> RelationIndex::GetPairs() const
+{
+	return m_pairs;
+}
+
+inline std::size_t RelationIndex::GetTarget(std::size_t source) const
+{
+	auto target = m_targets.find(source);
+	return target == m_targets.end() ? 0 : target->second;
+}
+
+inline std::span<const RelationIndex::Pair> RelationIndex::GetSources(std::size_t target) const
+{
+	auto [first, last] = std::ranges::equal_range(m_pairs, target, {}, &Pair::first);
+	return std::span<const Pair>(first, last);
+}
+
+inline ChangeVersion RelationIndex::GetVersion() const
+{
+	return m_version;
+}
+
+inline void RelationIndex::SetVersion(ChangeVersion version)
+{
+	m_version = version;
+}
+
+// Depth of every source of a relation in its trees, 1 for sources pointing at an object that isn't a source itself,
+// and the sources at each depth with their targets. Follows the index's changes, only sources that changed their
+// target and the ones under them get new depths. Sources in cycles never get one
+class RelationLevels
+{
+public:
+	// (source, target), unlike the index's pairs
+	using Link = std::pair<std::size_t, std::size_t>;
+
+	bool IsBuilt() const;
+	void Rebuild(const RelationIndex& index);
+
+	// Changes returned by RelationIndex::Update, after it
+	void Update(std::span<const RelationIndex::Pair> changes, const RelationIndex& index);
+
+	// Sources the index dropped, the ones under them keep their depth
+	void Remove(std::span<const std::size_t> sources);
+
+	std::size_t GetLevelCount() const;
+
+	// Sources at depth level + 1, sorted by id so each archetype's are next to each other
+	std::span<const Link> GetLevel(std::size_t level);
+private:
+	struct Entry
+	{
+		std::size_t Depth;
+		std::size_t Position; // In its level
+	};
+
+	std::unordered_map<std::size_t, Entry> m_entries;
+	std::vector<std::vector<Link>> m_levels;
+	std::vector<bool> m_unsorted;
+	bool m_built = false;
+
+	std::size_t GetDepth(std::size_t id) const;
+	void SetDepth(std::size_t source, std::size_t target, std::size_t depth);
+	void Erase(std::size_t source);
+
+	// Moves everything under the source to the depth below it
+	void Propagate(std::size_t source, const RelationIndex& index);
+};
+
+inline bool RelationLevels::IsBuilt() const
+{
+	return m_built;
+}
+
+inline void RelationLevels::Rebuild(const RelationIndex& index)
+{
+	m_entries.clear();
+	m_levels.clear();
+	m_unsorted.clear();
+
+	// Breadth first from the sources of objects that aren't sources themselves
+	std::vector<std::size_t> frontier;
+	for (auto [target, source] : index.GetPairs())
+	{
+		if (index.GetTarget(target) == 0)
+			frontier.push_back(source);
+	}
+
+	for (std::size_t depth = 1; !frontier.empty(); ++depth)
+	{
+		std::vector<std::size_t> next;
+		for (auto source : frontier)
+		{
+			SetDepth(source, index.GetTarget(source), depth);
+			for (auto [target, child] : index.GetSources(source))
+				next.push_back(child);
+		}
+
+		frontier = std::move(next);
+	}
+
+	m_built = true;
+}
+
+inline void RelationLevels::Update(std::span<const RelationIndex::Pair> changes, const RelationIndex& index)
+{
+	// A pass over everything beats following this many changes one by one
+	if (changes.size() > m_entries.size() / 4)
+	{
+		Rebuild(index);
+		return;
+	}
+
+	for (auto [target, source] : changes)
+	{
+		if (target == 0)
+			Erase(source);
+		else
+			SetDepth(source, target, GetDepth(target) + 1);
+
+		Propagate(source, index);
+	}
+}
+
+inline void RelationLevels::Remove(std::span<const std::size_t> sources)
+{
+	for (auto source : sources)
+		Erase(source);
+}
+
+inline std::size_t RelationLevels::GetLevelCount() const
+{
+	return m_levels.size();
+}
+
+inline std::span<const RelationLevels::Link> RelationLevels::GetLevel(std::size_t level)
+{
+	auto& links = m_levels[level];
+
+	if (m_unsorted[level])
+	{
+		std::ranges::sort(links);
+		for (std::size_t position = 0; position < links.size(); ++position)
+			m_entries[links[position].first].Position = position;
+
+		m_unsorted[level] = false;
+	}
+
+	return links;
+}
+
+inline std::size_t RelationLevels::GetDepth(std::size_t id) const
+{
+	auto entry = m_entries.find(id);
+	return entry == m_entries.end() ? 0 : entry->second.Depth;
+}
+
+inline void RelationLevels::SetDepth(std::size_t source, std::size_t target, std::size_t depth)
+{
+	auto entry = m_entries.find(source);
+	if (entry != m_entries.end())
+	{
+		// Moved to another target at the same depth
+		if (entry->second.Depth == depth)
+		{
+			m_levels[depth - 1][entry->second.Position].second = target;
+			return;
+		}
+
+		Erase(source);
+	}
+
+	if (m_levels.size() < depth)
+	{
+		m_levels.resize(depth);
+		m_unsorted.resize(depth);
+	}
+
+	m_levels[depth - 1].emplace_back(source, target);
+	m_unsorted[depth - 1] = true;
+	m_entries[source] = { depth, m_levels[depth - 1].size() - 1 };
+}
+
+inline void RelationLevels::Erase(std::size_t source)
+{
+	auto entry = m_entries.find(source);
+	if (entry == m_entries.end())
+		return;
+
+	auto level = entry->second.Depth - 1;
+	auto& links = m_levels[level];
+
+	// The last one takes its place
+	links[entry->second.Position] = links.back();
+	m_entries[links.back().first].Position = entry->second.Position;
+	links.pop_back();
+	m_unsorted[level] = true;
+
+	m_entries.erase(source);
+
+	while (!m_levels.empty() && m_levels.back().empty())
+	{
+		m_levels.pop_back();
+		m_unsorted.pop_back();
+	}
+}
+
+inline void RelationLevels::Propagate(std::size_t source, const RelationIndex& index)
+{
+	std::vector<std::size_t> pending = { source };
+
+	while (!pending.empty())
+	{
+		auto parent = pending.back();
+		pending.pop_back();
+
+		auto depth = GetDepth(parent) + 1;
+
+		// Deeper than there are sources means a cycle, which stays where it is
+		if (depth > m_entries.size() + 1)
+			continue;
+
+		for (auto [target, child] : index.GetSources(parent))
+		{
+			if (GetDepth(child) != depth)
+			{
+				SetDepth(child, parent, depth);
+				pending.push_back(child);
+			}
+		}
+	}
+}
+
+// Objects at sorted indices of a store view, each joined with an object of the target view if there is one, as rows
+// of (source index, target index). Iterating walks the source view forward like a normal query, so its writes stay
+// batched per block, and yields the source's components followed by the target's
+template<typename TSourceView, typename... TTargetView>
+class IndexedView : public std::ranges::view_interface<IndexedView<TSourceView, TTargetView...>>
+{
+	static_assert(sizeof...(TTargetView) <= 1, "Rows are joined with at most one target!");
+public:
+	using Row = std::pair<std::size_t, std::size_t>;
+private:
+	// Shared so copies of the view are cheap and iterators can point into it. The views keep the stores from
+	// compacting while rows refer to their indices
+	struct Shared
+	{
+		TSourceView Source;
+		std::tuple<TTargetView...> Targets;
+		std::vector<Row> Rows;
+		std::vector<std::size_t> TaskStarts;
+	};
+public:
+	class Iterator
+	{
+	public:
+		using SourceIterator = TSourceView::Iterator;
+
+		using reference = decltype(std::tuple_cat(std::declval<typename SourceIterator::reference>(), std::declval<typename TTargetView::Iterator::reference>()...));
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = reference;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator()
+		{
+		}
+
+		Iterator(Shared *rows, const Row *row, const Row *end) : m_rows(rows), m_row(row), m_end(end)
+		{
+			if (m_row != m_end)
+			{
+				m_source = m_rows->Source.GetIterator(m_row->first);
+				SetTargets();
+			}
+		}
+
+		Iterator& operator++()
+		{
+			auto previous = m_row++;
+
+			if (m_row != m_end)
+			{
+				m_source += static_cast<difference_type>(m_row->first - previous->first);
+				SetTargets();
+			}
+
+			return *this;
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator old = *this;
+			++(*this);
+			return old;
+		}
+
+		reference operator*() const
+		{
+			return std::apply([this](auto&... target) { return std::tuple_cat(*m_source, **target...); }, m_targets);
+		}
+
+		bool operator==(const Iterator& other) const
+		{
+			return m_row == other.m_row;
+		}
+	private:
+		Shared *m_rows = nullptr;
+		const Row *m_row = nullptr;
+		const Row *m_end = nullptr;
+		SourceIterator m_source;
+		std::tuple<std::optional<typename TTargetView::Iterator>...> m_targets;
+
+		void SetTargets()
+		{
+			std::apply([this](auto&... target)
+			{
+				std::apply([&](auto&... targetView) { (target.emplace(targetView.GetIterator(m_row->second)), ...); }, m_rows->Targets);
+			}, m_targets);
+		}
+	};
+
+	IndexedView() = default;
+
+	IndexedView(std::vector<std::pair<std::size_t, std::size_t>> rows, TSourceView source, TTargetView... targets)
+		: m_rows(std::make_shared<Shared>(std::move(source), std::make_tuple(std::move(targets)...), std::move(rows)))
+	{
+		// Rows split where they cross a task boundary of the source view, so tasks never write the same block
+		auto& taskStarts = m_rows->TaskStarts;
+		for (std::size_t row = 0; row < m_rows->Rows.size(); ++row)
+		{
+			if (row == 0 || m_rows->Rows[row].first / TSourceView::GetTaskSize() != m_rows->Rows[row - 1].first / TSourceView::GetTaskSize())
+				taskStarts.push_back(row);
+		}
+
+		taskStarts.push_back(m_rows->Rows.size());
+	}
+
+	Iterator begin() const
+	{
+		return Iterator(m_rows.get(), m_rows->Rows.data(), m_rows->Rows.data() + m_rows->Rows.size());
+	}
+
+	Iterator end() const
+	{
+		auto end = m_rows->Rows.data() + m_rows->Rows.size();
+		return Iterator(m_rows.get(), end, end);
+	}
+
+	std::size_t GetTaskCount() const
+	{
+		return m_rows->TaskStarts.size() - 1;
+	}
+
+	// Calls func with the components of each row of the task
+	template<typename TFunc>
+	void RunTask(std::size_t task, TFunc& func) const
+	{
+		auto rows = m_rows->Rows.data();
+		auto& taskStarts = m_rows->TaskStarts;
+
+		for (Iterator iter(m_rows.get(), rows + taskStarts[task], rows + taskStarts[task + 1]), end(m_rows.get(), rows + taskStarts[task + 1], rows + taskStarts[task + 1]); iter != end; ++iter)
+			std::apply(func, *iter);
+	}
+private:
+	std::shared_ptr<Shared> m_rows;
+};
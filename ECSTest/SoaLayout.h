@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <tuple>
+#include <type_traits>
+
+// Opt-in for storing a component's fields as separate columns inside each store block, so a scan only pulls in the
+// fields it touches. Specialize it with the fields that make up the component:
+//
+// template<>
+// struct SoaLayout<Position> : SoaFields<&Position::X, &Position::Y, &Position::Z> {};
+template<typename T>
+struct SoaLayout
+{
+	static constexpr bool Enabled = false;
+};
+
+template<typename TMember>
+struct SoaMemberTraits;
+
+template<typename TClass, typename TField>
+struct SoaMemberTraits<TField TClass::*>
+{
+	using Class = TClass;
+	using Field = TField;
+};
+
+template<auto... Members>
+struct SoaFields
+{
+private:
+	using MemberTypes = std::tuple<decltype(Members)...>;
+
+	static constexpr MemberTypes MEMBERS = { Members... };
+
+	template<auto Member, std::size_t I>
+	static constexpr bool IsMember()
+	{
+		if constexpr (std::same_as<decltype(Member), std::tuple_element_t<I, MemberTypes>>)
+			return Member == std::get<I>(MEMBERS);
+		else
+			return false;
+	}
+
+	template<auto Member, std::size_t I = 0>
+	static constexpr std::size_t FindMember()
+	{
+		static_assert(I < sizeof...(Members), "Field is not part of the component's SoA layout!");
+
+		if constexpr (IsMember<Member, I>())
+			return I;
+		else
+			return FindMember<Member, I + 1>();
+	}
+public:
+	static constexpr bool Enabled = true;
+	static constexpr std::size_t FIELD_COUNT = sizeof...(Members);
+
+	template<std::size_t I>
+	using FieldType = typename SoaMemberTraits<std::tuple_element_t<I, MemberTypes>>::Field;
+
+	template<auto Member>
+	static constexpr std::size_t FIELD_INDEX = FindMember<Member>();
+
+	template<std::size_t I>
+	static constexpr auto FIELD_MEMBER = std::get<I>(MEMBERS);
+
+	// Byte offset of field I's column in a block holding Capacity components
+	template<std::size_t I, std::size_t Capacity>
+	static constexpr std::size_t GetColumnOffset()
+	{
+		if constexpr (I == 0)
+		{
+			return 0;
+		}
+		else
+		{
+			constexpr auto end = GetColumnOffset<I - 1, Capacity>() + sizeof(FieldType<I - 1>) * Capacity;
+			constexpr auto alignment = alignof(FieldType<I>);
+
+			return (end + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	template<std::size_t Capacity>
+	static constexpr std::size_t GetBlockBytes()
+	{
+		return GetColumnOffset<FIELD_COUNT - 1, Capacity>() + sizeof(FieldType<FIELD_COUNT - 1>) * Capacity;
+	}
+};
+
+template<typename T>
+concept SoaComponent = SoaLayout<std::remove_const_t<T>>::Enabled;
+
+// Proxy returned by store iterators for SoA components. Fields are reached with Get<&T::Field>(), and the whole
+// component can be read or written by converting from or assigning to a T
+template<typename TIter, std::size_t Capacity>
+class SoaReference
+{
+public:
+	using Component = std::remove_const_t<TIter>;
+	using Layout = SoaLayout<Component>;
+	using BlockPointer = std::conditional_t<std::is_const_v<TIter>, const std::byte *, std::byte *>;
+
+	static constexpr inline bool IsConst = std::is_const_v<TIter>;
+
+	SoaReference(BlockPointer block, std::size_t index) : m_block(block), m_index(index)
+	{
+	}
+
+	SoaReference(const SoaReference& other) = default;
+
+	// Assignment writes through the proxy like it would through a reference
+	SoaReference& operator=(const SoaReference& other) requires (!IsConst)
+	{
+		return *this = static_cast<Component>(other);
+	}
+
+	SoaReference& operator=(const Component& value) requires (!IsConst)
+	{
+		AssignFields(value, std::make_index_sequence<Layout::FIELD_COUNT>());
+		return *this;
+	}
+
+	operator Component() const
+	{
+		Component value{};
+		GatherFields(value, std::make_index_sequence<Layout::FIELD_COUNT>());
+
+		return value;
+	}
+
+	template<auto Member>
+	auto& Get() const
+	{
+		return Field<Layout::template FIELD_INDEX<Member>>();
+	}
+
+	template<std::size_t I>
+	auto& Field() const
+	{
+		using TField = std::conditional_t<IsConst, const typename Layout::template FieldType<I>, typename Layout::template FieldType<I>>;
+		return reinterpret_cast<TField *>(m_block + Layout::template GetColumnOffset<I, Capacity>())[m_index];
+	}
+private:
+	BlockPointer m_block;
+	std::size_t m_index;
+
+	template<std::size_t... Is>
+	void AssignFields(const Component& value, std::index_sequence<Is...>)
+	{
+		((Field<Is>() = value.*(Layout::template FIELD_MEMBER<Is>)), ...);
+	}
+
+	template<std::size_t... Is>
+	void GatherFields(Component& value, std::index_sequence<Is...>) const
+	{
+		((value.*(Layout::template FIELD_MEMBER<Is>) = Field<Is>()), ...);
+	}
+};
+
+// Chunk access to a SoA component, every field is handed out as its own array
+template<typename TIter, std::size_t Capacity>
+class SoaSpan
+{
+public:
+	using Layout = SoaLayout<std::remove_const_t<TIter>>;
+	using BlockPointer = SoaReference<TIter, Capacity>::BlockPointer;
+
+	SoaSpan(BlockPointer block, std::size_t first, std::size_t count) : m_block(block), m_first(first), m_count(count)
+	{
+	}
+
+	template<auto Member>
+	auto Get() const
+	{
+		return Field<Layout::template FIELD_INDEX<Member>>();
+	}
+
+	template<std::size_t I>
+	auto Field() const
+	{
+		return std::span(&SoaReference<TIter, Capacity>(m_block, m_first).template Field<I>(), m_count);
+	}
+
+	SoaReference<TIter, Capacity> operator[](std::size_t index) const
+	{
+		return SoaReference<TIter, Capacity>(m_block, m_first + index);
+	}
+
+	std::size_t size() const
+	{
+		return m_count;
+	}
+private:
+	BlockPointer m_block;
+	std::size_t m_first;
+	std::size_t m_count;
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs batches of indexed tasks on a fixed set of workers plus the calling thread. Each participant starts with an
+// even, contiguous share of the tasks and takes them front to back, and one that runs dry steals the back half of
+// the fullest share left, so neighbouring tasks mostly stay on the same thread
+class ThreadPool
+{
+public:
+	// threadCount includes the thread calling ParallelFor
+	explicit ThreadPool(std::size_t threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Calls func(task) for every task in [0, taskCount) and returns once all of them are done. Batches from
+	// different threads run one after another, calling it from inside a task is not supported
+	template<typename TFunc>
+	void ParallelFor(std::size_t taskCount, TFunc&& func);
+
+	std::size_t GetThreadCount() const;
+
+	// Pool sized to the machine, started on first use
+	static ThreadPool& GetShared();
+
+	// Index of the calling thread in its pool, below GetThreadCount. 0 for threads that aren't workers, the thread
+	// calling ParallelFor runs tasks as 0 too. Lets tasks pick per-thread state such as command buffers
+	static std::size_t GetCurrentThreadIndex();
+private:
+	// Remaining tasks of a participant as [begin, end), packed into a word so taking and stealing are one CAS
+	struct alignas(64) Share
+	{
+		std::atomic_uint64_t Range = 0;
+	};
+
+	std::vector<std::thread> m_workers;
+	std::vector<Share> m_shares;
+
+	std::mutex m_batchLock;
+	void (*m_run)(void *, std::size_t);
+	void *m_context;
+
+	std::atomic_uint64_t m_batch;
+	std::atomic_size_t m_pendingTasks;
+	std::atomic_size_t m_busyWorkers;
+	std::atomic_bool m_stopping;
+
+	static inline thread_local std::size_t m_threadIndex = 0;
+
+	void WorkerLoop(std::size_t share);
+	void RunTasks(std::size_t share);
+
+	bool TakeTask(std::size_t share, std::size_t& task);
+	bool StealTasks(std::size_t share);
+
+	static std::uint64_t PackRange(std::uint64_t begin, std::uint64_t end);
+};
+
+inline ThreadPool::ThreadPool(std::size_t threadCount) :
+	m_shares(std::max<std::size_t>(threadCount, 1)), m_run(nullptr), m_context(nullptr),
+	m_batch(0), m_pendingTasks(0), m_busyWorkers(0), m_stopping(false)
+{
+	// Share 0 belongs to the calling thread
+	for (std::size_t share = 1; share < m_shares.size(); ++share)
+		m_workers.emplace_back([this, share]() { WorkerLoop(share); });
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	m_stopping = true;
+	++m_batch;
+	m_batch.notify_all();
+
+	for (auto& worker : m_workers)
+		worker.join();
+}
+
+template<typename TFunc>
+inline void ThreadPool::ParallelFor(std::size_t taskCount, TFunc&& func)
+{
+	if (taskCount == 0)
+		return;
+
+	std::lock_guard lock(m_batchLock);
+
+	m_run = [](void *context, std::size_t task) { (*static_cast<std::remove_reference_t<TFunc> *>(context))(task); };
+	m_context = &func;
+	m_pendingTasks = taskCount;
+
+	// Shares are published after the function, so whoever takes a task sees the function it belongs to
+	auto shareCount = m_shares.size();
+	for (std::size_t share = 0; share < shareCount; ++share)
+		m_shares[share].Range = PackRange(taskCount * share / shareCount, taskCount * (share + 1) / shareCount);
+
+	++m_batch;
+	m_batch.notify_all();
+
+	RunTasks(0);
+
+	// Tasks taken by workers may still be running, and a worker must be out of the batch before the next one starts
+	for (auto pending = m_pendingTasks.load(); pending > 0; pending = m_pendingTasks.load())
+		m_pendingTasks.wait(pending);
+
+	for (auto busy = m_busyWorkers.load(); busy > 0; busy = m_busyWorkers.load())
+		m_busyWorkers.wait(busy);
+}
+
+inline std::size_t ThreadPool::GetThreadCount() const
+{
+	return m_shares.size();
+}
+
+inline ThreadPool& ThreadPool::GetShared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+inline std::size_t ThreadPool::GetCurrentThreadIndex()
+{
+	return m_threadIndex;
+}
+
+inline void ThreadPool::WorkerLoop(std::size_t share)
+{
+	std::uint64_t seenBatch = 0;
+	m_threadIndex = share;
+
+	while (true)
+	{
+		m_batch.wait(seenBatch);
+		seenBatch = m_batch.load();
+
+		if (m_stopping)
+			return;
+
+		++m_busyWorkers;
+		RunTasks(share);
+
+		if (--m_busyWorkers == 0)
+			m_busyWorkers.notify_all();
+	}
+}
+
+inline void ThreadPool::RunTasks(std::size_t share)
+{
+	std::size_t task;
+
+	do
+	{
+		while (TakeTask(share, task))
+		{
+			m_run(m_context, task);
+
+			if (--m_pendingTasks == 0)
+				m_pendingTasks.notify_all();
+		}
+	} while (StealTasks(share));
+}
+
+inline bool ThreadPool::TakeTask(std::size_t share, std::size_t& task)
+{
+	auto& range = m_shares[share].Range;
+	auto packed = range.load();
+
+	while (true)
+	{
+		auto begin = packed & 0xFFFFFFFF;
+		auto end = packed >> 32;
+
+		if (begin >= end)
+			return false;
+
+		if (range.compare_exchange_weak(packed, PackRange(begin + 1, end)))
+		{
+			task = begin;
+			return true;
+		}
+	}
+}
+
+inline bool ThreadPool::StealTasks(std::size_t share)
+{
+	auto shareCount = m_shares.size();
+
+	while (true)
+	{
+		// Fullest share, starting the search past our own so thieves spread out
+		std::size_t victim = share;
+		std::uint64_t victimPacked = 0;
+		std::uint64_t victimCount = 0;
+
+		for (std::size_t offset = 1; offset < shareCount; ++offset)
+		{
+			auto other = (share + offset) % shareCount;
+			auto packed = m_shares[other].Range.load();
+			auto count = (packed >> 32) - std::min(packed >> 32, packed & 0xFFFFFFFF);
+
+			if (count > victimCount)
+			{
+				victim = other;
+				victimPacked = packed;
+				victimCount = count;
+			}
+		}
+
+		if (victimCount == 0)
+			return false;
+
+		// Back half, the owner keeps working on the front
+		auto begin = victimPacked & 0xFFFFFFFF;
+		auto end = victimPacked >> 32;
+		auto middle = end - (victimCount + 1) / 2;
+
+		if (m_shares[victim].Range.compare_exchange_strong(victimPacked, PackRange(begin, middle)))
+		{
+			m_shares[share].Range = PackRange(middle, end);
+			return true;
+		}
+	}
+}
+
+inline std::uint64_t ThreadPool::PackRange(std::uint64_t begin, std::uint64_t end)
+{
+	return begin | end << 32;
+}
@@ -4,9 +4,10 @@
 
 int main()
 {
-    const auto poolSize = 256 * 1024 * 1024; // 256 MB
+    const auto poolSize = 256 * 1024 * 1024; // 256 MB reserved, committed on demand
     MemoryPool::Initialize(poolSize / BLOCK_SIZE);
 
 
+    EpochReclaimer::Drain();
     MemoryPool::Destroy();
 }
\ No newline at end of file